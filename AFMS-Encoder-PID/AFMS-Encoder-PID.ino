@@ -10,11 +10,11 @@
 
 #define DEBUG_VERBOSE	0
 
-#include <Wire.h>
-#include <Adafruit_MotorShield.h>
 #include <Encoder.h>
 #include <PID_v1.h>
 #include <PID_AutoTune_v0.h>
+#include <AxisAlly_TWI.h>
+#include <AxisAlly_MotorShield2.h>
 
 const int adaMotor = 1;
 const int pinEncoderA = 18;
@@ -30,9 +30,20 @@ long posMotorFuture;
 long posMotorDelta;
 int rateMotor = 0;
 
-Adafruit_MotorShield motorAFMS = Adafruit_MotorShield();
+/* I2C from the TWI interrupt, so loop() doesn't wait on the bus.
+ * This takes the place of Wire, which can't be used alongside it.
+ */
+AxisAlly_TWIQueue<AxisAlly_TWIAVR> twi;
+
+ISR(TWI_vect)
+{
+	twi.interrupt();
+}
+
+/* Motor writes are collected and sent as one I2C burst, at 400KHz */
+AxisAlly_MotorShield2<AxisAlly_TWIQueue<AxisAlly_TWIAVR> > motorAFMS(&twi);
 
-Adafruit_DCMotor *motorM1 = motorAFMS.getMotor(1);
+AxisAlly_MotorShield2DC<AxisAlly_TWIQueue<AxisAlly_TWIAVR> > *motorM1 = motorAFMS.getMotor(adaMotor);
 
 Encoder encMotor(pinEncoderA, pinEncoderB);
 
@@ -44,7 +55,7 @@ const double pidKdM1 = 0.0001;
 PID pidM1(&pidM1Input, &pidM1Output, &pidM1Desired, pidKpM1, pidKiM1, pidKdM1, DIRECT);
 PID_ATune pidATuneM1(&pidM1Input, &pidM1Output);
 
-void motor_home(Adafruit_DCMotor *m, Encoder *e)
+void motor_home(AxisAlly_MotorShield2DC<AxisAlly_TWIQueue<AxisAlly_TWIAVR> > *m, Encoder *e)
 {
 	long pos, pos_new;
 
@@ -78,6 +89,7 @@ bool tuned;
 void setup() {
 	Serial.begin(115200);
 
+	twi.begin();
 	motorAFMS.begin();
 	motorM1->setSpeed(0);
 	motorM1->run(RELEASE);
@@ -175,6 +187,7 @@ void loop() {
 //Serial.print("input=");Serial.print(pidM1Input);
 //Serial.print(", desired=");Serial.print(pidM1Desired);
 //Serial.print(", output=");Serial.println(pidM1Output);
+		motorAFMS.hold();
 		if (pidM1Output == 0) {
 			motorM1->run(RELEASE);
 		} else if (pidM1Output < 0) {
@@ -184,6 +197,7 @@ void loop() {
 			motorM1->setSpeed(pidM1Output + pwmMinimum);
 			motorM1->run(FORWARD);
 		}
+		motorAFMS.flush();
 	}
 }
 
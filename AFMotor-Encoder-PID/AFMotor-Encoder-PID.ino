@@ -6,96 +6,85 @@
  * Adafruit Motorshield v1
  * P18 -> Optical encoder input A
  * P14 -> Optical encoder input B
+ *
+ * The encoder is sampled on every change of A (B has no interrupt on
+ * the Mega, so its changes are picked up with A's), and the axis holds
+ * position on the time-interpolated position between counts rather
+ * than the count itself.
+ *
+ * Once autotuned, the axis homes and takes moves. The tuned gains are
+ * only a starting point: while moving, the axis keeps fitting a model
+ * of the motor and rescales them (within 4x either way) as it grows
+ * weaker or stronger.
  */
 
 #define DEBUG_VERBOSE	1
 
 #include <Wire.h>
 #include <AFMotor.h>
-#include <Encoder.h>
-#include <PID_v1.h>
 #include <PID_AutoTune_v0.h>
+#include <AxisAlly_Encoder.h>
+#include <AxisAlly_DCEncoder.h>
 
 const int adaMotor = 1;
+/* Above hearing, so the motor doesn't whine. The minimum PWM that
+ * turns the motor depends on this, so measure it again if it changes.
+ */
+const int pwmFrequency = MOTOR12_64KHZ;
 const int pinEncoderA = 18;
 const int pinEncoderB = 14;
 
 const int pwmMinimum = 80;
 const int pwmMaximum = 255;
 
+/* Counts/sec, and counts/sec per sec */
+#define MAX_VELOCITY		2000
+#define MAX_ACCELERATION	8000
+
 int dir = -1;
 int neg = 0;
-long posMotorPast;
 long posMotorFuture;
-long posMotorDelta;
-int rateMotor = 0;
 
-AF_DCMotor imotorM1(adaMotor);
-AF_DCMotor *motorM1;
+AF_DCMotor motorM1(adaMotor, pwmFrequency);
+
+AxisAlly_Encoder encMotor(pinEncoderA, pinEncoderB);
 
-Encoder encMotor(pinEncoderA, pinEncoderB);
+AxisAlly_DCEncoder<AF_DCMotor, AxisAlly_Encoder> axis(&motorM1, &encMotor);
+AxisAlly_GainAdapt adapt;
 
+void encoderChange() {
+	encMotor.update();
+}
+
+/* The autotuner drives the motor directly, through axis.drive() */
 double pidM1Desired, pidM1Input, pidM1Output;
 
 const double pidKpM1 = 0.01782;
 const double pidKiM1 = 0.00085;
-const double pidKdM1 = 0.00000;
 bool tuned = false;
 
-PID pidM1(&pidM1Input, &pidM1Output, &pidM1Desired, pidKpM1, pidKiM1, pidKdM1, DIRECT);
 PID_ATune pidATuneM1(&pidM1Input, &pidM1Output);
 
-void motor_home(AF_DCMotor *m, Encoder *e)
-{
-	long pos, pos_new;
-
-	if (tuned) {
-		// Home the motor
-		motorM1->setSpeed(pwmMinimum+(pwmMaximum-pwmMinimum)/4);
-		motorM1->run(BACKWARD);
-
-		// Find the minimum position
-		pos_new = e->read();
-		do {
-			pos = pos_new;
-			delay(100);
-			pos_new = e->read();
-		} while (pos_new != pos);
-	}
-
-	motorM1->setSpeed(0);
-	motorM1->run(RELEASE);
-
-	pidM1Desired = 0;
-	pidM1Input = 0;
-	pidM1Output = 0;
-	e->write(0);
-
-	posMotorPast = 0;
-	posMotorFuture = 0;
-	posMotorDelta = 0;
-}
-
 void setup() {
 	Serial.begin(115200);
 
-	motorM1 = &imotorM1;
-	motorM1->setSpeed(0);
-	motorM1->run(RELEASE);
-
 	pinMode(pinEncoderA, INPUT);
 	pinMode(pinEncoderB, INPUT);
+	attachInterrupt(digitalPinToInterrupt(pinEncoderA), encoderChange, CHANGE);
 
-	motor_home(motorM1, &encMotor);
+	axis.setPWMRange(pwmMinimum, pwmMaximum);
+	axis.setGains(pidKpM1, pidKiM1);
+	axis.setVelocityMax(MAX_VELOCITY);
+	axis.setAccelerationMax(MAX_ACCELERATION);
+	axis.begin();
+	axis.setLocation(0);
 
-	/* Initialize the PID */
-	pidM1.SetOutputLimits(-1.0, 1.0);
-	pidM1.SetMode(AUTOMATIC);
+	pidM1Desired = 0;
+	pidM1Input = 0;
+	pidM1Output = 0;
+	posMotorFuture = 0;
 
 	pidATuneM1.SetOutputStep(0.1);
-
-	/* Get a direction */
-	Serial.print("Steps: ");
 }
 
 bool readNextPosition() {
@@ -106,8 +95,8 @@ bool readNextPosition() {
 				/* Go there */
 				dir *= (neg ? -1 : 1);
 				Serial.print("\r\nGo: "); Serial.print(dir); Serial.print("\r\n");
-				posMotorDelta = dir;
-				posMotorFuture += posMotorDelta;
+				posMotorFuture += dir;
+				axis.moveLocation(posMotorFuture);
 			}
 
 			/* Get a direction */
@@ -145,60 +134,65 @@ bool readNextPosition() {
 unsigned long ms_last;
 
 void loop() {
-	long posMotorNow = encMotor.read();
 	bool delta;
 
 	if (tuned && readNextPosition())
 		return;
 
-	pidM1Desired= posMotorFuture;
-	pidM1Input = posMotorNow;
-
 	unsigned long ms_now = millis();
 	if ((ms_now - ms_last) < 10) {
 		return;
 	}
-	ms_last = ms_now;
 
-	if (!tuned) {
-		delta = (pidATuneM1.Runtime() == 0);
-		tuned = !delta;
-		if (tuned) {
-			Serial.print("Kp=");Serial.print(pidATuneM1.GetKp());
-			Serial.print("Ki=");Serial.print(pidATuneM1.GetKi());
-			Serial.print("Kd=");Serial.println(pidATuneM1.GetKd());
-			pidM1.SetTunings(pidATuneM1.GetKp(),
-					 pidATuneM1.GetKi(),
-					 pidATuneM1.GetKd());
-			pidM1.SetControllerDirection(DIRECT);
-			motorM1->run(RELEASE);
-			for (;;);
+	if (tuned) {
+		if (!axis.update(ms_now - ms_last) && axis.getFault()) {
+			Serial.print("Fault ");Serial.print(axis.getFault());
+			Serial.print(" at ");Serial.println(axis.getLocation());
+			posMotorFuture = axis.getLocation();
+			axis.clearFault();
 		}
-	} else {
-		delta = pidM1.Compute();
-	}
-
-	if (delta) {
+		ms_last = ms_now;
 #if DEBUG_VERBOSE
 		static int nsteps = 0;
 		nsteps++;
 		if (nsteps == 100) {
-			Serial.print("input=");Serial.print(pidM1Input);
-			Serial.print(", desired=");Serial.print(pidM1Desired);
-			Serial.print(", output=");Serial.println(pidM1Output);
+			Serial.print("input=");Serial.print(encMotor.position());
+			Serial.print(", desired=");Serial.print(posMotorFuture);
+			Serial.print(", velocity=");Serial.print(axis.getVelocity());
+			Serial.print(", kp=");Serial.print(adapt.getKp(), 5);
+			Serial.print(", ki=");Serial.println(adapt.getKi(), 5);
 			nsteps = 0;
 		}
 #endif
-		if (pidM1Output == 0) {
-			motorM1->run(RELEASE);
-		} else if (pidM1Output < 0) {
-			motorM1->setSpeed(-pidM1Output*(pwmMaximum-pwmMinimum) + pwmMinimum);
-			motorM1->run(BACKWARD);
-		} else {
-			motorM1->setSpeed(pidM1Output*(pwmMaximum-pwmMinimum) + pwmMinimum);
-			motorM1->run(FORWARD);
-		}
+		return;
+	}
+	ms_last = ms_now;
+
+	pidM1Desired = posMotorFuture;
+	pidM1Input = axis.getLocation();
+
+	delta = (pidATuneM1.Runtime() == 0);
+	tuned = !delta;
+	if (tuned) {
+		Serial.print("Kp=");Serial.print(pidATuneM1.GetKp());
+		Serial.print("Ki=");Serial.print(pidATuneM1.GetKi());
+		Serial.print("Kd=");Serial.println(pidATuneM1.GetKd());
+		axis.setGains(pidATuneM1.GetKp(), pidATuneM1.GetKi());
+		axis.setAdaptive(&adapt);
+
+		/* Homing only makes sense once tuned */
+		axis.setHoming(pwmMinimum+(pwmMaximum-pwmMinimum)/4, 0);
+		axis.begin();
+		posMotorFuture = axis.getLocation();
+		ms_last = millis();
+
+		/* Get a direction */
+		Serial.print("Steps: ");
+		return;
 	}
+
+	if (delta)
+		axis.drive(pidM1Output);
 }
 
 
@@ -35,17 +35,22 @@
 #define AXISALLY_MIN    INT_MIN
 #define AXISALLY_MAX    INT_MAX
 
+/* Why a hardware axis stopped itself */
+#define AXISALLY_FAULT_NONE       0
+#define AXISALLY_FAULT_STALL      1     /* Driven, but not moving */
+#define AXISALLY_FAULT_FOLLOWING  2     /* Too far behind the plan */
+#define AXISALLY_FAULT_ENDSTOP    3     /* Ran onto an endstop */
+
 #define BUG(f,args...) do { if (0) printf(f ,##args ); } while (0)
 
+/* Runtime-polymorphic axis interface
+ *   Use this when the concrete axis type isn't known until runtime,
+ *   or several kinds of axis need to live behind one pointer. Each
+ *   call costs an indirect jump, and every class has a vtable in RAM.
+ *   Wrap a static axis in AxisAlly_Virtual<> to get one of these.
+ */
 class AxisAlly {
     public:
-        AxisAlly() {
-            _location_min = AXISALLY_MIN;
-            _location_max = AXISALLY_MAX;
-
-            _velocity_max = 100.0;        /* 100 units per 1s */
-            _acceleration_max = 10.0;      /* +10units/sec per sec */
-        }
         virtual ~AxisAlly() { }
 
         /* Perform the initial motor activation and homing
@@ -57,6 +62,9 @@ class AxisAlly {
          */
         virtual bool update(long delta_ms) = 0;
 
+        /* Same as update(), for callers with a microsecond clock */
+        virtual bool updateMicros(long delta_us) = 0;
+
         /* Set the current location (for homing) */
         virtual void setLocation(int location) = 0;
         virtual int getLocation() = 0;
@@ -65,7 +73,71 @@ class AxisAlly {
         virtual float getVelocity() = 0;
 
         /* Move to new location */
-        virtual void moveLocation(int location) {
+        virtual void moveLocation(int location) = 0;
+
+        /* Set the location limits
+         *   Initially, these are AXISALLY_MIN and AXISALLY_MAX
+         */
+        virtual void setLocationRange(int min_location, int max_location) = 0;
+
+        /* Set maximum acceleration pointer
+         *   Acceleration is |delta_velocity/delta_time|
+         */
+        virtual void setAccelerationMax(float acceleration_max) = 0;
+        virtual float getAccelerationMax() = 0;
+
+        /* Set maximum velocity
+         *   Velocity is |delta_location/delta_time|
+         */
+        virtual void setVelocityMax(float velocity_max) = 0;
+        virtual float getVelocityMax() = 0;
+};
+
+/* Compile-time polymorphic axis
+ *   The same interface as AxisAlly, but resolved at compile time
+ *   (CRTP): Axis is the concrete class deriving from this, and must
+ *   provide begin(), update(), updateMicros(), setLocation(),
+ *   getLocation() and getVelocity(). Generic code takes an AxisAlly_Static<Axis> & and
+ *   every call inlines straight into Axis, with no vtable at all.
+ */
+template <class Axis>
+class AxisAlly_Static {
+    public:
+        AxisAlly_Static() {
+            _moveto = 0;
+            _location_min = AXISALLY_MIN;
+            _location_max = AXISALLY_MAX;
+
+            _velocity_max = 100.0;        /* 100 units per 1s */
+            _acceleration_max = 10.0;      /* +10units/sec per sec */
+        }
+
+        void begin() {
+            axis()->begin();
+        }
+
+        bool update(long delta_ms) {
+            return axis()->update(delta_ms);
+        }
+
+        bool updateMicros(long delta_us) {
+            return axis()->updateMicros(delta_us);
+        }
+
+        void setLocation(int location) {
+            axis()->setLocation(location);
+        }
+
+        int getLocation() {
+            return axis()->getLocation();
+        }
+
+        float getVelocity() {
+            return axis()->getVelocity();
+        }
+
+        /* Move to new location */
+        void moveLocation(int location) {
             if (location > _location_max)
                 location = _location_max;
             else if (location < _location_min)
@@ -76,7 +148,7 @@ class AxisAlly {
         /* Set the location limits
          *   Initially, these are AXISALLY_MIN and AXISALLY_MAX
          */
-        virtual void setLocationRange(int min_location, int max_location) {
+        void setLocationRange(int min_location, int max_location) {
             _location_min = min_location;
             _location_max = max_location;
         }
@@ -84,58 +156,223 @@ class AxisAlly {
         /* Set maximum acceleration pointer
          *   Acceleration is |delta_velocity/delta_time|
          */
-        virtual void setAccelerationMax(float acceleration_max) {
+        void setAccelerationMax(float acceleration_max) {
             _acceleration_max = acceleration_max;
         }
 
-        virtual float getAccelerationMax() {
+        float getAccelerationMax() {
             return _acceleration_max;
         }
 
         /* Set maximum velocity
          *   Velocity is |delta_location/delta_time|
          */
-        virtual void setVelocityMax(float velocity_max) {
+        void setVelocityMax(float velocity_max) {
             _velocity_max = velocity_max;
         }
 
-        virtual float getVelocityMax() {
+        float getVelocityMax() {
             return _velocity_max;
         }
 
 
 protected:
+        /* Step a trajectory planner (an AxisAlly_SimStatic) toward this
+         * axis' target, under this axis' limits
+         *   Hardware backends follow the planner's location. Once it
+         *   reports the move done, it's parked exactly on the target so
+         *   it doesn't creep on with its last sliver of velocity.
+         */
+        template <class Plan>
+        bool plan(Plan &profile, long delta_us) {
+            bool moving;
+
+            profile.setLocationRange(_location_min, _location_max);
+            profile.setVelocityMax(_velocity_max);
+            profile.setAccelerationMax(_acceleration_max);
+            profile.moveLocation(_moveto);
+
+            moving = profile.updateMicros(delta_us);
+            if (!moving)
+                profile.stopAt(_moveto);
+
+            return moving;
+        }
+
+
         int _moveto;    /* Desired location */
         int _location_min;      /* Min allowed location */
         int _location_max;      /* Max allowed location */
 
         float _acceleration_max;
         float _velocity_max;
+
+    private:
+        Axis *axis() {
+            return static_cast<Axis *>(this);
+        }
 };
 
-class AxisAlly_Sim : public AxisAlly {
+/* Runtime adapter for a static axis
+ *   AxisAlly_Virtual<Axis> is an Axis that can also be used through
+ *   an AxisAlly pointer.
+ */
+template <class Axis>
+class AxisAlly_Virtual : public AxisAlly, public Axis {
     public:
-        AxisAlly_Sim() : AxisAlly() {
-            _millis = 0;
+        AxisAlly_Virtual() { }
+
+        /* Hardware axes take their motor (and encoder) at construction */
+        template <class A>
+        AxisAlly_Virtual(A a) : Axis(a) { }
+
+        template <class A, class B>
+        AxisAlly_Virtual(A a, B b) : Axis(a, b) { }
+
+        template <class A, class B, class C>
+        AxisAlly_Virtual(A a, B b, C c) : Axis(a, b, c) { }
+
+        virtual void begin() {
+            Axis::begin();
+        }
+
+        virtual bool update(long delta_ms) {
+            return Axis::update(delta_ms);
+        }
+
+        virtual bool updateMicros(long delta_us) {
+            return Axis::updateMicros(delta_us);
+        }
+
+        virtual void setLocation(int location) {
+            Axis::setLocation(location);
+        }
+
+        virtual int getLocation() {
+            return Axis::getLocation();
+        }
+
+        virtual float getVelocity() {
+            return Axis::getVelocity();
+        }
+
+        virtual void moveLocation(int location) {
+            Axis::moveLocation(location);
+        }
+
+        virtual void setLocationRange(int min_location, int max_location) {
+            Axis::setLocationRange(min_location, max_location);
+        }
+
+        virtual void setAccelerationMax(float acceleration_max) {
+            Axis::setAccelerationMax(acceleration_max);
+        }
+
+        virtual float getAccelerationMax() {
+            return Axis::getAccelerationMax();
+        }
+
+        virtual void setVelocityMax(float velocity_max) {
+            Axis::setVelocityMax(velocity_max);
+        }
+
+        virtual float getVelocityMax() {
+            return Axis::getVelocityMax();
+        }
+};
+
+/* Loop period statistics
+ *   Tracks the typical time between updates and how much it wanders.
+ *   The period is only used to look ahead one tick when deciding to
+ *   stop; the acceleration steps themselves use each tick's own dt.
+ *
+ *   Both are exponential averages (1/8 weight, plain average over the
+ *   first 8 samples). A sample further from the period than a few
+ *   jitters - a stray Serial.print(), a debugger pause - is clipped
+ *   to that bound first, so one bad tick can only nudge the estimate.
+ */
+class AxisAlly_LoopStats {
+    public:
+        AxisAlly_LoopStats() {
+            _samples = 0;
+            _period = 0.0;
+            _jitter = 0.0;
+        }
+
+        /* Record the time since the last update, in microseconds
+         *   Returns it in seconds
+         */
+        float update(long delta_us) {
+            float sec = delta_us / 1000000.0;
+
+            if (_samples == 0) {
+                _period = sec;
+            } else {
+                float gain = 1.0 / (_samples < 8 ? _samples + 1 : 8);
+                float deviation = sec - _period;
+                float limit = 4 * _jitter + _period / 8;
+
+                if (deviation > limit)
+                    deviation = limit;
+                else if (deviation < -limit)
+                    deviation = -limit;
+
+                _period += deviation * gain;
+                _jitter += (fabsf(deviation) - _jitter) * gain;
+            }
+
+            if (_samples < 8)
+                _samples++;
+
+            return sec;
+        }
+
+        /* Get the typical # of seconds between each call to loop
+         */
+        float average() {
+            return _period;
+        }
+
+        /* Get the mean deviation from average(), in seconds
+         */
+        float jitter() {
+            return _jitter;
+        }
+
+    private:
+        int   _samples;        /* Samples seen, up to 8 */
+        float _period;         /* Estimated loop period */
+        float _jitter;         /* Mean absolute deviation */
+};
+
+class AxisAlly_SimStatic : public AxisAlly_Static<AxisAlly_SimStatic> {
+    public:
+        AxisAlly_SimStatic() {
             _last_location = 0.0;
             _last_velocity = 0.0;
+            _brake_margin = 1.2;
         }
 
-        virtual void begin() {
+        void begin() {
         }
 
         /* Process location updates
          *   Returns false if no movements are pending
          */
-        virtual bool update(long delta_ms) {
-            float location, moveto_delta;
+        bool update(long delta_ms) {
+            return updateMicros(delta_ms * 1000);
+        }
+
+        bool updateMicros(long delta_us) {
+            float location, moveto_delta, bound_delta;
             float velocity, location_delta, b_distance;
-            float sec;
+            float sec, loop_sec;
             bool moving = true;
 
-            sec = update_milli_stats(delta_ms);
-            if (sec == 0.0)
+            if (delta_us <= 0)
                 return false;
+            sec = _loop.update(delta_us);
+            loop_sec = _loop.average();
 
             /* SIMULATION! */
             location_delta = _last_velocity * sec;
@@ -156,24 +393,32 @@ BUG("dl %f, dv %f, dt %f\n", location_delta, _last_velocity, sec);
 
             int moveto_dir = moveto_delta < 0 ? -1 : 1;
             int velocity_dir = velocity < 0 ? -1 : 1;
-            if (moveto_dir * moveto_delta > velocity_dir * velocity * _loop_sec_avg ) {
+            if (moveto_dir * moveto_delta > velocity_dir * velocity * loop_sec ) {
 
                 /* Are we within the braking distance at this velocity? */
                 b_distance = velocity * velocity / _acceleration_max;
 
-                /* See if we need to slow down */
-                if (b_distance * 1.2 > fabsf(moveto_delta)) {
-                    float delta = -moveto_dir * _acceleration_max * _loop_sec_avg;
+                /* Room left before the end of the range we're heading for */
+                bound_delta = velocity_dir > 0 ? _location_max - location :
+                                                 location - _location_min;
+
+                /* See if we need to slow down: for the target, or (with
+                 * any braking margin) to stop within the range
+                 */
+                if (b_distance * _brake_margin > fabsf(moveto_delta) ||
+                    b_distance / 2 > bound_delta - velocity_dir * velocity * loop_sec) {
+                    float delta = -velocity_dir * _acceleration_max * sec;
     BUG("SLOW DOWN- v %f, dv %f (braking distance %f)\n", velocity, delta, b_distance);
-                    /* Time to slow down! */
+                    /* Time to slow down! (brake against the current
+                     * motion, which may be away from the target) */
                     velocity += delta;
-                    if (moveto_dir * velocity < 0)
+                    if (velocity_dir * velocity < 0)
                         velocity = 0;
                 } else if (moveto_dir * velocity < _velocity_max) {
-                    float delta = moveto_dir * _acceleration_max * _loop_sec_avg;
+                    float delta = moveto_dir * _acceleration_max * sec;
     BUG("SPEED UP - v %f, dv %f (braking distance %f)\n", velocity, delta, b_distance);
                     /* Speed up! */
-                    velocity += moveto_dir * _acceleration_max * _loop_sec_avg;
+                    velocity += delta;
                     if (moveto_dir * velocity >  _velocity_max)
                         velocity = moveto_dir * _velocity_max;
                 }
@@ -190,49 +435,59 @@ BUG("dt %f, @%d -> %d, v=%f, a=%f (%f-%f)/%f\n", sec, (int)location, (int)_movet
             return moving;
         }
 
-        virtual float getVelocity() {
+        float getVelocity() {
             return _last_velocity;
         }
 
-    private:
+        /* Set the current location (for homing) */
+        void setLocation(int location) {
+            _last_location = location;
+        }
 
-        /* Get the average # of seconds between each call to loop
-         */
-        float update_milli_stats(long delta_ms) {
-            if (_millis == 0)
-                _milli_total = 0;
-            if (_millis >= 7)
-                _milli_total -= _milli[_millis & 7];
-            _millis++;
-            _milli[_millis & 7] = delta_ms;
-            _milli_total += delta_ms;
-          
-            if (_millis < 8)
-                _loop_sec_avg = _milli_total / 1000.0 / _millis;
-            else
-                _loop_sec_avg = _milli_total / 1000.0 / 8.0;
+        int getLocation() {
+            return (int)_last_location;
+        }
 
-            return delta_ms / 1000.0;
+        /* Stop dead at a location */
+        void stopAt(int location) {
+            _last_location = location;
+            _last_velocity = 0.0;
         }
 
+        /* Set the braking margin
+         *   Braking starts once the braking distance times this
+         *   margin exceeds the remaining distance. Larger values
+         *   brake earlier; smaller values arrive sooner but risk
+         *   overshooting.
+         */
+        void setBrakeMargin(float brake_margin) {
+            _brake_margin = brake_margin;
+        }
 
-        /* Set the current location (for homing) */
-        virtual void setLocation(int location) {
-            _last_location = location;
+        float getBrakeMargin() {
+            return _brake_margin;
         }
-        virtual int getLocation() {
-            return (int)_last_location;
+
+        /* Get the estimated loop period, and its jitter, in seconds */
+        float getLoopPeriod() {
+            return _loop.average();
+        }
+
+        float getLoopJitter() {
+            return _loop.jitter();
         }
 
     protected:
         long _last_millis;   /* Last time */
         float _last_location;  /* Last known location */
         float _last_velocity;  /* Last velocity */
+        float _brake_margin;   /* Braking distance safety factor */
+
+        AxisAlly_LoopStats _loop;
+};
 
-        long  _milli[8];
-        int   _millis;
-        long  _milli_total;
-        float _loop_sec_avg;
+/* The simulator behind an AxisAlly pointer */
+class AxisAlly_Sim : public AxisAlly_Virtual<AxisAlly_SimStatic> {
 };
           
 
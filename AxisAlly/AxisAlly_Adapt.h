@@ -0,0 +1,296 @@
+/*
+ * Online refinement of a DC axis' gains
+ *
+ * Gains tuned once (by hand or PID_ATune) are right for the motor as
+ * it was then. Belt tension, load and temperature change how fast it
+ * answers the drive, and over a long job the tuning drifts away from
+ * what it was meant to be. This watches ordinary moves and rescales the
+ * gains to keep up, without taking the axis over for a test.
+ *
+ * The motor is taken as first order from drive output u (-1..1) to
+ * velocity v, plus a constant that starts it moving (the minimum PWM,
+ * or friction). Both are averaged over each sample interval T, so the
+ * output of the interval before counts too:
+ *
+ *   v[n] = a v[n-1] + b u[n] + c u[n-1] + d sign(u[n])
+ *
+ * a to d are fitted by recursive least squares with a forgetting
+ * factor, so old behaviour fades in a second or two; that's a fixed
+ * handful of multiplies per interval, whatever the history. From them,
+ * the time constant is tau = -T / ln(a) and the full-output speed gain
+ * is K = (b + c) / (1 - a). Intervals in which the drive was off,
+ * reversed, or too small to move the motor tell little and are skipped.
+ * T wants to be long enough for a count either way to be small beside
+ * the counts moved: a count's noise in v[n-1] makes tau look shorter.
+ *
+ * The gains given to begin() are taken as right for the motor as first
+ * measured. After that, kp and ki go with 1 / K, so a count of error
+ * still asks for the same speed: a motor grown weaker gets more drive.
+ * tau is estimated but left to the tuning's margin. Scaling for it too
+ * (kp with 1 / (K tau), to hold a linear loop's damping) rang more
+ * than fixed gains did in test.cpp, where the deadband and braking at
+ * the end of a move count for more than damping.
+ *
+ * The gains move by no more than a small fraction per second, so the
+ * burst of poor estimates in a hard reversal barely shifts them, and
+ * never outside a range around the tuned ones (setLimits()), whatever
+ * the estimate says. An estimate that isn't physical (a outside 0..1,
+ * or b + c not positive) changes nothing.
+ *
+ * AxisAlly_DCEncoder feeds this from update() once setAdaptive() is
+ * called.
+ */
+
+#ifndef AXISALLY_ADAPT_H
+#define AXISALLY_ADAPT_H
+
+#include <math.h>
+
+#define AXISALLY_ADAPT_SETTLE   50      /* Intervals before the reference */
+#define AXISALLY_ADAPT_N        4       /* Parameters fitted */
+#define AXISALLY_ADAPT_P0       100.0   /* Initial covariance, per parameter */
+#define AXISALLY_ADAPT_PMAX     1000.0  /* Most it may grow to, in total */
+
+class AxisAlly_GainAdapt {
+    public:
+        AxisAlly_GainAdapt() {
+            _sample = 0.02;
+            _forget = 0.98;
+            _range = 4.0;
+            _slew = 0.1;
+            _output_min = 0.02;
+
+            begin(0.0, 0.0, 1.0);
+        }
+
+        /* Seconds per fit; a few per motor time constant */
+        void setSample(float sec) {
+            _sample = sec;
+        }
+
+        /* How much of the fit each interval keeps; 1 - 1/n remembers
+         * about n intervals
+         */
+        void setForgetting(float lambda) {
+            _forget = lambda;
+        }
+
+        /* Gains stay within range times the tuned ones, either way,
+         * and move by no more than the fraction slew per second
+         */
+        void setLimits(float range, float slew) {
+            _range = range;
+            _slew = slew;
+        }
+
+        /* Start again from tuned gains
+         *   velocity_scale is a typical speed (e.g. the axis' maximum),
+         *   in the units given to sample(), to keep the fit well
+         *   conditioned.
+         */
+        void begin(float kp, float ki, float velocity_scale) {
+            _kp = _kp0 = kp;
+            _ki = _ki0 = ki;
+            _scale = velocity_scale > 0.0 ? velocity_scale : 1.0;
+
+            restart();
+            _theta[0] = 0.5;
+            for (int i = 1; i < AXISALLY_ADAPT_N; i++)
+                _theta[i] = 0.0;
+            _last_output = 0.0;
+            _fits = 0;
+            _ref_gain = 0.0;
+            _gain = 0.0;
+            _tau = 0.0;
+        }
+
+        /* Each control tick: the output driven over the tick, and how
+         * far the motor moved in it
+         *   Returns true if the gains changed.
+         */
+        bool sample(float output, float moved, float sec) {
+            float v;
+            bool changed = false;
+
+            if (output < _output_min && output > -_output_min)
+                _steady = false;
+            else if (_sum_sec > 0.0 && (output < 0) != (_sum_output < 0))
+                _steady = false;
+            _sum_output += output * sec;
+            _sum_moved += moved;
+            _sum_sec += sec;
+            if (_sum_sec < _sample)
+                return false;
+
+            v = _sum_moved / _sum_sec / _scale;
+            if (_steady && _have_last)
+                changed = fit(v, _sum_output / _sum_sec, _sum_sec);
+
+            _last = v;
+            _last_output = _sum_output / _sum_sec;
+            _have_last = true;
+            _steady = true;
+            _sum_output = 0.0;
+            _sum_moved = 0.0;
+            _sum_sec = 0.0;
+
+            return changed;
+        }
+
+        /* Forget the last velocity, e.g. after the axis was stopped by
+         * something other than the drive
+         */
+        void restart() {
+            for (int i = 0; i < AXISALLY_ADAPT_N; i++)
+                for (int j = 0; j < AXISALLY_ADAPT_N; j++)
+                    _p[i][j] = i == j ? AXISALLY_ADAPT_P0 : 0.0;
+            _have_last = false;
+            _steady = true;
+            _sum_output = 0.0;
+            _sum_moved = 0.0;
+            _sum_sec = 0.0;
+        }
+
+        float getKp() {
+            return _kp;
+        }
+
+        float getKi() {
+            return _ki;
+        }
+
+        /* The motor as last estimated: velocity per unit output, and
+         * its time constant in seconds; 0 until there's an estimate
+         */
+        float getGain() {
+            return _gain;
+        }
+
+        float getTimeConstant() {
+            return _tau;
+        }
+
+        /* Intervals fitted since begin() */
+        unsigned long fits() {
+            return _fits;
+        }
+
+    private:
+        /* One step of recursive least squares on
+         *   v = a last + b u + c last_output + d sign(u)
+         */
+        bool fit(float v, float u, float sec) {
+            float phi[AXISALLY_ADAPT_N], pphi[AXISALLY_ADAPT_N], k[AXISALLY_ADAPT_N];
+            float denom, error, trace, a;
+
+            phi[0] = _last;
+            phi[1] = u;
+            phi[2] = _last_output;
+            phi[3] = u < 0 ? -1.0 : 1.0;
+
+            denom = _forget;
+            for (int i = 0; i < AXISALLY_ADAPT_N; i++) {
+                pphi[i] = 0.0;
+                for (int j = 0; j < AXISALLY_ADAPT_N; j++)
+                    pphi[i] += _p[i][j] * phi[j];
+                denom += phi[i] * pphi[i];
+            }
+
+            error = v;
+            for (int i = 0; i < AXISALLY_ADAPT_N; i++) {
+                k[i] = pphi[i] / denom;
+                error -= _theta[i] * phi[i];
+            }
+            /* P stays symmetric: only the upper half is worked out,
+             * so rounding can't pull it away from positive definite
+             */
+            trace = 0.0;
+            for (int i = 0; i < AXISALLY_ADAPT_N; i++) {
+                _theta[i] += k[i] * error;
+                for (int j = i; j < AXISALLY_ADAPT_N; j++)
+                    _p[j][i] = _p[i][j] -= k[i] * pphi[j];
+                trace += _p[i][i];
+            }
+            /* Forgetting only while there's something to forget: in a
+             * direction the drive hasn't explored lately (output held
+             * steady, say), P would otherwise grow without bound
+             */
+            if (trace < AXISALLY_ADAPT_PMAX)
+                for (int i = 0; i < AXISALLY_ADAPT_N; i++)
+                    for (int j = 0; j < AXISALLY_ADAPT_N; j++)
+                        _p[i][j] /= _forget;
+
+            _fits++;
+            a = _theta[0];
+            if (a <= 0.0 || a >= 1.0 || _theta[1] + _theta[2] <= 0.0)
+                return false;
+            _tau = -sec / logf(a);
+            _gain = (_theta[1] + _theta[2]) / (1.0 - a) * _scale;
+
+            if (_fits < AXISALLY_ADAPT_SETTLE)
+                return false;
+            if (_ref_gain == 0.0) {
+                /* The motor the tuned gains were for */
+                _ref_gain = _gain;
+                return false;
+            }
+
+            return retune(sec);
+        }
+
+        /* Move the gains toward keeping K kp and K ki as they were,
+         * within the limits
+         */
+        bool retune(float sec) {
+            float r = _ref_gain / _gain;
+            float kp = step(_kp, _kp0 * r, _kp0, sec);
+            float ki = step(_ki, _ki0 * r, _ki0, sec);
+            bool changed = kp != _kp || ki != _ki;
+
+            _kp = kp;
+            _ki = ki;
+            return changed;
+        }
+
+        float step(float now, float want, float tuned, float sec) {
+            float most = now * (1.0 + _slew * sec);
+            float least = now * (1.0 - _slew * sec);
+
+            if (want > most)
+                want = most;
+            else if (want < least)
+                want = least;
+            if (want > tuned * _range)
+                want = tuned * _range;
+            else if (want < tuned / _range)
+                want = tuned / _range;
+            return want;
+        }
+
+        float _sample;                  /* Seconds per fit */
+        float _forget;                  /* Forgetting factor */
+        float _range;                   /* Gains within tuned *, / this */
+        float _slew;                    /* Most change per second */
+        float _output_min;              /* Less is as good as off */
+        float _scale;                   /* Velocity units per fit unit */
+
+        float _kp0, _ki0;               /* Tuned */
+        float _kp, _ki;                 /* Now */
+
+        float _theta[AXISALLY_ADAPT_N]; /* a, b, c, d */
+        float _p[AXISALLY_ADAPT_N][AXISALLY_ADAPT_N];
+        unsigned long _fits;
+        float _gain, _tau;              /* From the latest fit */
+        float _ref_gain;                /* When the tuned gains applied */
+
+        float _last;                    /* Velocity over the last interval */
+        float _last_output;             /* Output over it */
+        bool _have_last;
+        bool _steady;                   /* Driven one way throughout */
+        float _sum_output;              /* Output-seconds this interval */
+        float _sum_moved;               /* Counts this interval */
+        float _sum_sec;
+};
+
+#endif /* AXISALLY_ADAPT_H */
+/* vim: set shiftwidth=4 expandtab:  */
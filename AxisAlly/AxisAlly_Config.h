@@ -0,0 +1,344 @@
+/*
+ * Axis configuration, kept in EEPROM
+ *
+ * Pins, travel limits, PWM range and gains are normally constants in
+ * the sketch, so trying new gains means flashing it again, and what
+ * an autotune run finds is gone at the next reset. Here they are a
+ * struct the sketch defines (Config), held in RAM and read from there;
+ * EEPROM is only touched by load() at start and by save() on request.
+ *
+ * Each save() goes to the next of a ring of slots, so the EEPROM's
+ * 100,000 write cycles are spread over all of them, and only bytes
+ * that differ are written. A slot holds the version the sketch gave,
+ * a sequence number, the struct, and a CRC-16 over all of that (and the
+ * struct's size). load() takes the valid slot with the latest sequence
+ * number; with none, or only an older version, it keeps the defaults.
+ * So a save cut short by a reset leaves the one before it in place.
+ *
+ * Store is EEPROM, or anything with its read(address) and
+ * write(address, value). A table of fields (AXISALLY_CONFIG_FIELD)
+ * names the struct's members for command(), which takes lines from
+ * the serial port:
+ *
+ *   get                list every field
+ *   get kp             one field
+ *   set kp 0.05        change it in RAM
+ *   save               keep it in EEPROM
+ *   load               back to what was last saved
+ *   defaults           back to the sketch's defaults
+ */
+
+#ifndef AXISALLY_CONFIG_H
+#define AXISALLY_CONFIG_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Kinds of field */
+#define AXISALLY_CONFIG_INT     1
+#define AXISALLY_CONFIG_LONG    2
+#define AXISALLY_CONFIG_FLOAT   3
+
+/* The kind of a member, as the size of what these return */
+char (&axisally_config_kind(int *))[AXISALLY_CONFIG_INT];
+char (&axisally_config_kind(long *))[AXISALLY_CONFIG_LONG];
+char (&axisally_config_kind(float *))[AXISALLY_CONFIG_FLOAT];
+
+/* One entry in the field table, e.g.
+ *   AXISALLY_CONFIG_FIELD(AxisConfig, kp)
+ */
+#define AXISALLY_CONFIG_FIELD(type, member) \
+    { #member, sizeof(axisally_config_kind(&((type *)0)->member)), \
+      offsetof(type, member) }
+
+struct AxisAlly_ConfigField {
+    const char *name;
+    unsigned char kind;                 /* AXISALLY_CONFIG_* */
+    unsigned int offset;                /* Into the struct */
+};
+
+template <class Config, class Store>
+class AxisAlly_ConfigStore {
+    public:
+        /* slots of size(1) bytes each, from address; version is the
+         * sketch's, to be changed whenever Config is. defaults and
+         * fields are kept by reference, so make them globals.
+         */
+        AxisAlly_ConfigStore(Store *eeprom, int address, int slots,
+                             unsigned char version, const Config &defaults,
+                             const AxisAlly_ConfigField *fields, int count) {
+            _eeprom = eeprom;
+            _address = address;
+            _slots = slots;
+            _version = version;
+            _defaults = &defaults;
+            _fields = fields;
+            _count = count;
+
+            _config = defaults;
+            _slot = slots - 1;          /* So the first save() is slot 0 */
+            _sequence = 0;
+        }
+
+        /* Bytes taken by the given number of slots */
+        static int size(int slots) {
+            return slots * (int)(sizeof(Config) + 5);
+        }
+
+        /* Read the latest saved configuration
+         *   Returns false, keeping the defaults, if there is none.
+         */
+        bool load() {
+            bool found = false;
+
+            for (int s = 0; s < _slots; s++) {
+                unsigned int sequence, ahead;
+
+                if (!valid(s, &sequence))
+                    continue;
+                /* Later, allowing for the 16 bits wrapping */
+                ahead = (sequence - _sequence) & 0xffff;
+                if (found && (ahead == 0 || ahead >= 0x8000))
+                    continue;
+                found = true;
+                _slot = s;
+                _sequence = sequence;
+            }
+            if (!found) {
+                _config = *_defaults;
+                return false;
+            }
+
+            read(_slot, &_config);
+            return true;
+        }
+
+        /* Write the configuration to the next slot */
+        void save() {
+            unsigned char *bytes = (unsigned char *)&_config;
+            unsigned int crc;
+            int at;
+
+            _slot = (_slot + 1) % _slots;
+            _sequence = (_sequence + 1) & 0xffff;
+            at = _address + _slot * (int)(sizeof(Config) + 5);
+
+            crc = header(_sequence);
+            update(at++, _version);
+            update(at++, _sequence & 0xff);
+            update(at++, _sequence >> 8);
+            for (unsigned int i = 0; i < sizeof(Config); i++) {
+                crc = crc16(crc, bytes[i]);
+                update(at++, bytes[i]);
+            }
+            update(at++, crc & 0xff);
+            update(at, crc >> 8);
+        }
+
+        /* The configuration, in RAM */
+        Config &get() {
+            return _config;
+        }
+
+        void defaults() {
+            _config = *_defaults;
+        }
+
+        /* Slot the last save() or load() used */
+        int slot() {
+            return _slot;
+        }
+
+        /* Carry out one command line (see above), answering to Serial
+         * or anything with its print()s
+         *   Returns false if it wasn't understood.
+         */
+        template <class Out>
+        bool command(const char *line, Out &out) {
+            const char *arg;
+
+            while (*line == ' ')
+                line++;
+            arg = word(line);
+
+            if (is(line, "get")) {
+                if (!*arg) {
+                    for (int i = 0; i < _count; i++)
+                        show(&_fields[i], out);
+                    return true;
+                }
+                const AxisAlly_ConfigField *f = find(arg);
+                if (!f)
+                    return unknown(out);
+                show(f, out);
+                return true;
+            }
+            if (is(line, "set")) {
+                const AxisAlly_ConfigField *f = find(arg);
+
+                if (!f || !parse(f, word(arg)))
+                    return unknown(out);
+                show(f, out);
+                return true;
+            }
+            if (is(line, "save")) {
+                save();
+                out.print("saved\r\n");
+                return true;
+            }
+            if (is(line, "load")) {
+                out.print(load() ? "loaded\r\n" : "defaults\r\n");
+                return true;
+            }
+            if (is(line, "defaults")) {
+                defaults();
+                out.print("defaults\r\n");
+                return true;
+            }
+
+            return unknown(out);
+        }
+
+    private:
+        /* CRC-16/CCITT, a bit at a time: small, and save() is rare */
+        static unsigned int crc16(unsigned int crc, unsigned char byte) {
+            crc ^= (unsigned int)byte << 8;
+            for (int i = 0; i < 8; i++)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            return crc & 0xffff;
+        }
+
+        unsigned int header(unsigned int sequence) {
+            unsigned int crc = 0xffff;
+
+            crc = crc16(crc, sizeof(Config) & 0xff);
+            crc = crc16(crc, sizeof(Config) >> 8);
+            crc = crc16(crc, _version);
+            crc = crc16(crc, sequence & 0xff);
+            return crc16(crc, sequence >> 8);
+        }
+
+        /* Is slot s this version, and intact? */
+        bool valid(int s, unsigned int *sequence) {
+            int at = _address + s * (int)(sizeof(Config) + 5);
+            unsigned int crc, stored;
+
+            if (_eeprom->read(at) != _version)
+                return false;
+            *sequence = _eeprom->read(at + 1) | _eeprom->read(at + 2) << 8;
+            crc = header(*sequence);
+            at += 3;
+            for (unsigned int i = 0; i < sizeof(Config); i++)
+                crc = crc16(crc, _eeprom->read(at++));
+
+            stored = _eeprom->read(at) | _eeprom->read(at + 1) << 8;
+            return stored == crc;
+        }
+
+        void read(int s, Config *config) {
+            unsigned char *bytes = (unsigned char *)config;
+            int at = _address + s * (int)(sizeof(Config) + 5) + 3;
+
+            for (unsigned int i = 0; i < sizeof(Config); i++)
+                bytes[i] = _eeprom->read(at++);
+        }
+
+        /* A write costs 3.3ms and a little wear: only if it changed */
+        void update(int at, unsigned char value) {
+            if (_eeprom->read(at) != value)
+                _eeprom->write(at, value);
+        }
+
+        /* The next word after the one at text, or "" */
+        static const char *word(const char *text) {
+            while (*text && *text != ' ')
+                text++;
+            while (*text == ' ')
+                text++;
+            return text;
+        }
+
+        /* Is the word at text this one? */
+        static bool is(const char *text, const char *name) {
+            int n = strlen(name);
+
+            return !strncmp(text, name, n) && (!text[n] || text[n] == ' ');
+        }
+
+        const AxisAlly_ConfigField *find(const char *name) {
+            for (int i = 0; i < _count; i++)
+                if (is(name, _fields[i].name))
+                    return &_fields[i];
+            return 0;
+        }
+
+        /* Set a field from text; false, leaving it alone, if that
+         * isn't a number, or is out of range for the field
+         */
+        bool parse(const AxisAlly_ConfigField *f, const char *text) {
+            unsigned char *at = (unsigned char *)&_config + f->offset;
+            char *end;
+
+            if (f->kind == AXISALLY_CONFIG_FLOAT) {
+                double value = strtod(text, &end);
+
+                if (end == text || (*end && *end != ' '))
+                    return false;
+                *(float *)at = value;
+            } else {
+                long value;
+
+                errno = 0;
+                value = strtol(text, &end, 10);
+                if (end == text || (*end && *end != ' ') || errno == ERANGE)
+                    return false;
+                if (f->kind == AXISALLY_CONFIG_INT &&
+                    (value < INT_MIN || value > INT_MAX))
+                    return false;
+                if (f->kind == AXISALLY_CONFIG_INT)
+                    *(int *)at = value;
+                else
+                    *(long *)at = value;
+            }
+            return true;
+        }
+
+        template <class Out>
+        void show(const AxisAlly_ConfigField *f, Out &out) {
+            unsigned char *at = (unsigned char *)&_config + f->offset;
+
+            out.print(f->name);
+            out.print(" ");
+            if (f->kind == AXISALLY_CONFIG_FLOAT)
+                out.print((double)*(float *)at, 5);
+            else if (f->kind == AXISALLY_CONFIG_INT)
+                out.print((long)*(int *)at);
+            else
+                out.print(*(long *)at);
+            out.print("\r\n");
+        }
+
+        template <class Out>
+        bool unknown(Out &out) {
+            out.print("?\r\n");
+            return false;
+        }
+
+        Store *_eeprom;
+        int _address;
+        int _slots;
+        unsigned char _version;
+        const Config *_defaults;
+        const AxisAlly_ConfigField *_fields;
+        int _count;
+
+        Config _config;                 /* What everything reads */
+        int _slot;                      /* Last saved or loaded */
+        unsigned int _sequence;         /* Its sequence number */
+};
+
+#endif /* AXISALLY_CONFIG_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,925 @@
+/*
+ * AxisAlly for a DC motor with a quadrature encoder
+ *
+ * Motor is AF_DCMotor (Motor Shield v1) or Adafruit_DCMotor (v2); both
+ * take setSpeed(0..255) and run(FORWARD/BACKWARD/BRAKE/RELEASE). Enc is
+ * the PJRC Encoder, or anything else with read() and write(). Include
+ * this after the motor library, which defines the run() constants.
+ *
+ * The move is planned by an AxisAlly_SimStatic under this axis' limits,
+ * and the motor is driven to follow the planned location: velocity
+ * feedforward plus PI on the position error (in encoder counts), mapped
+ * onto the PWM range the motor actually turns in.
+ *
+ * A stalled or jammed motor is caught by comparing how far the encoder
+ * moved against how far the drive should have moved it, summed over a
+ * fixed window (so the per-update cost is a few adds). If it moved less
+ * than a quarter of that, or falls too far behind the plan, the motor
+ * is released and the axis faults until clearFault().
+ *
+ * The ends of setLocationRange() are enforced here too, not just where
+ * commands are parsed: the plan brakes to stop inside the range, and
+ * at or past either end the motor is never driven further out. Endstop
+ * switches, if any, stop the motor from the pin change interrupt (see
+ * endstop()) rather than whenever loop() next comes round.
+ *
+ * Motor speed is neither linear in PWM nor the same both ways round,
+ * so calibrate() can sweep the PWM in both directions and build a
+ * lookup from velocity back to PWM (see AxisAlly_PWMTable), which can
+ * be kept in EEPROM. With one, the controller's output is a velocity,
+ * as a fraction of full speed, rather than a duty cycle.
+ *
+ * The position error is taken from axisally_position(), which is the
+ * count for any encoder, but for one that can interpolate between
+ * counts (AxisAlly_Encoder) is overloaded to give its finer position,
+ * so the motor doesn't hunt between two counts while holding.
+ *
+ * With backlash between the motor and the carriage, the motor encoder
+ * says where the motor is, not the carriage. setLoadEncoder() adds a
+ * second encoder on the carriage (the load) and makes this a dual loop:
+ * locations are then the carriage's, and the motor is still driven on
+ * its own encoder, fast, but to the planned location plus a correction
+ * that a slow outer loop finds from the carriage encoder. That is kept
+ * separately for each direction of travel: driving forward the motor
+ * leads the carriage by one side of the gap, backward by the other.
+ * Their difference is the backlash (getBacklash()). Each is measured
+ * only while the carriage is actually being pushed that way, so taking
+ * up the gap doesn't upset it, and pushed on if the motor gets to its
+ * target with the carriage still short (the gap not known yet); and
+ * at a reversal the motor target switches straight to the other
+ * direction's correction, so the gap is taken up at the motor's speed
+ * rather than the outer loop's. A move is done when the carriage is
+ * within the deadband, not just the motor.
+ *
+ * setAdaptive() hands the motion of every update to an
+ * AxisAlly_GainAdapt, which keeps the gains tuned as the motor's
+ * response drifts.
+ */
+
+#ifndef AXISALLY_DCENCODER_H
+#define AXISALLY_DCENCODER_H
+
+#include <AxisAlly.h>
+#include <AxisAlly_Profile.h>
+#include <AxisAlly_Adapt.h>
+
+#define AXISALLY_PWM_STEPS      16      /* Lookup points per direction */
+#define AXISALLY_PWM_SWEEP      32      /* PWM levels calibrate() tries */
+#define AXISALLY_PWM_MAGIC      0xa5    /* Marks a saved table */
+
+/* Position feedback, in counts */
+template <class Enc>
+inline float axisally_position(Enc *encoder, long count)
+{
+    return count;
+}
+
+/* Velocity to PWM lookup for a DC motor
+ *   One table per direction. Entry i is the PWM that turns the motor
+ *   at i / (AXISALLY_PWM_STEPS - 1) of that direction's full speed, so
+ *   a lookup is one multiply and an interpolation. Entry 0 is the most
+ *   PWM that still doesn't turn it, so the least bit of velocity asked
+ *   for starts right at the edge of the deadband.
+ *
+ *   Saved as a magic byte, the table, and a checksum byte, to anything
+ *   with the read(address) and write(address, byte) of Arduino's EEPROM.
+ */
+class AxisAlly_PWMTable {
+    public:
+        AxisAlly_PWMTable() {
+            clear();
+        }
+
+        void clear() {
+            unsigned char *bytes = (unsigned char *)&_cal;
+
+            for (unsigned int i = 0; i < sizeof(_cal); i++)
+                bytes[i] = 0;
+        }
+
+        bool valid() {
+            return _cal.velocity_full[0] > 0.0 && _cal.velocity_full[1] > 0.0;
+        }
+
+        /* Full speed, counts/sec: forward (dir >= 0) or backward */
+        float getFullSpeed(int dir) {
+            return _cal.velocity_full[dir < 0];
+        }
+
+        /* Fill in one direction from a sweep
+         *   velocity[k] is the speed (counts/sec, either way round)
+         *   measured at pwm[k], with pwm ascending.
+         */
+        void build(int dir, const unsigned char *pwm,
+                   const unsigned int *velocity, int n) {
+            unsigned char *table = _cal.pwm[dir < 0];
+            unsigned int v[AXISALLY_PWM_SWEEP];
+            int i, k, still;
+
+            /* Speed only goes up with PWM; anything else is noise */
+            still = 0;
+            for (k = 0; k < n; k++) {
+                v[k] = velocity[k];
+                if (k > 0 && v[k] < v[k - 1])
+                    v[k] = v[k - 1];
+                if (v[k] == 0)
+                    still = k;
+            }
+
+            _cal.velocity_full[dir < 0] = v[n - 1];
+            table[0] = pwm[still];
+
+            for (i = 1, k = 0; i < AXISALLY_PWM_STEPS; i++) {
+                float target = (float)v[n - 1] * i / (AXISALLY_PWM_STEPS - 1);
+
+                while (k < n - 1 && v[k] < target)
+                    k++;
+                if (k == 0 || v[k] == v[k - 1]) {
+                    table[i] = pwm[k];
+                    continue;
+                }
+
+                table[i] = pwm[k - 1] + (pwm[k] - pwm[k - 1]) *
+                           (target - v[k - 1]) / (v[k] - v[k - 1]) + 0.5;
+            }
+        }
+
+        /* PWM for a velocity (counts/sec); the sign picks the table */
+        int pwm(float velocity) {
+            const unsigned char *table = _cal.pwm[velocity < 0];
+            float x;
+            int i;
+
+            if (velocity == 0.0)
+                return 0;
+
+            x = fabsf(velocity) / _cal.velocity_full[velocity < 0] *
+                (AXISALLY_PWM_STEPS - 1);
+            if (x >= AXISALLY_PWM_STEPS - 1)
+                return table[AXISALLY_PWM_STEPS - 1];
+
+            i = x;
+            return table[i] + (table[i + 1] - table[i]) * (x - i) + 0.5;
+        }
+
+        /* Bytes save() takes up */
+        static int size() {
+            return sizeof(_cal) + 2;
+        }
+
+        template <class Store>
+        void save(Store &eeprom, int address) {
+            const unsigned char *bytes = (const unsigned char *)&_cal;
+            unsigned char sum = AXISALLY_PWM_MAGIC;
+
+            eeprom.write(address++, AXISALLY_PWM_MAGIC);
+            for (unsigned int i = 0; i < sizeof(_cal); i++) {
+                eeprom.write(address++, bytes[i]);
+                sum += bytes[i];
+            }
+            eeprom.write(address, sum);
+        }
+
+        /* Returns false, leaving the table alone, if nothing valid was
+         * saved there
+         */
+        template <class Store>
+        bool load(Store &eeprom, int address) {
+            AxisAlly_PWMTable saved;
+            unsigned char *bytes = (unsigned char *)&saved._cal;
+            unsigned char sum = AXISALLY_PWM_MAGIC;
+
+            if (eeprom.read(address++) != AXISALLY_PWM_MAGIC)
+                return false;
+            for (unsigned int i = 0; i < sizeof(saved._cal); i++) {
+                bytes[i] = eeprom.read(address++);
+                sum += bytes[i];
+            }
+            if (eeprom.read(address) != sum || !saved.valid())
+                return false;
+
+            _cal = saved._cal;
+            return true;
+        }
+
+    private:
+        struct {
+            float velocity_full[2];     /* Forward, backward */
+            unsigned char pwm[2][AXISALLY_PWM_STEPS];
+        } _cal;
+};
+
+template <class Motor, class Enc, class Load = Enc>
+class AxisAlly_DCEncoderStatic :
+        public AxisAlly_Static<AxisAlly_DCEncoderStatic<Motor, Enc, Load> > {
+    public:
+        AxisAlly_DCEncoderStatic(Motor *motor, Enc *encoder) {
+            _motor = motor;
+            _encoder = encoder;
+            _load = 0;                  /* Single loop */
+            _load_ratio = 1.0;
+            _load_tau = 0.5;
+            _load_dir = 1;
+            _load_last = 0;
+            _slack[0] = 0.0;
+            _slack[1] = 0.0;
+
+            _pwm_min = 80;
+            _pwm_max = 255;
+            _velocity_full = 0.0;       /* No feedforward */
+            _kp = 0.01782;              /* From AFMotor-Encoder-PID's */
+            _ki = 0.00085;              /* autotune run */
+            _deadband = 1;
+
+            _home_pwm = 0;              /* No homing */
+            _home_location = 0;
+            _home_pin = -1;
+
+            _endstop_min = -1;          /* No endstops */
+            _endstop_max = -1;
+            _endstop_hit = false;
+            _drive_dir = 0;
+
+            _pwm_out = -1;              /* Unknown until first written */
+            _run_out = -1;
+
+            _count = 0;
+            _velocity = 0.0;
+            _integral = 0.0;
+            _output = 0.0;
+            _adapt = 0;                 /* Fixed gains */
+
+            _fault = AXISALLY_FAULT_NONE;
+            _following_max = 0;         /* No following error limit */
+            _stall_window = 0.25;
+            _stall_ratio = 0.25;
+            _stall_time = 0.0;
+            _stall_expected = 0.0;
+            _stall_moved = 0.0;
+        }
+
+        /* Release the motor, and home it if setHoming() was called
+         */
+        void begin() {
+            drive(0);
+            _count = _encoder->read();
+            if (_load)
+                _load_last = loadLocation();
+            if (_home_pwm)
+                home();
+        }
+
+        /* Process location updates
+         *   Returns false if no movements are pending
+         */
+        bool update(long delta_ms) {
+            return updateMicros(delta_ms * 1000);
+        }
+
+        bool updateMicros(long delta_us) {
+            bool moving;
+            long count, here;
+            float sec, output, error, target;
+            AXISALLY_PROFILE_SCOPE(control);
+
+            if (delta_us <= 0 || _fault)
+                return false;
+            sec = delta_us / 1000000.0;
+
+            moving = this->plan(_profile, delta_us);
+
+            AXISALLY_PROFILE_ENTER(encoder_read);
+            count = _encoder->read();
+            AXISALLY_PROFILE_EXIT(encoder_read);
+            _velocity = (count - _count) / sec;
+            _stall_moved += fabsf(count - _count);
+            if (_adapt && _adapt->sample(_output, count - _count, sec)) {
+                _kp = _adapt->getKp();
+                _ki = _adapt->getKi();
+            }
+            _count = count;
+
+            if (_endstop_hit || endstopAhead()) {
+                fault(AXISALLY_FAULT_ENDSTOP);
+                return false;
+            }
+
+            target = _profile.getLocation();
+            here = count;
+            if (_load) {
+                here = loadLocation();
+                target += outerLoop(moving, count, here, sec);
+            }
+
+            error = target - axisally_position(_encoder, count);
+            if (!moving && error <= _deadband && error >= -_deadband) {
+                /* The motor is there; wait on the outer loop for the
+                 * carriage, holding still
+                 */
+                if (_load && fabsf(_profile.getLocation() - here) >
+                             _deadband + _load_ratio / 2) {
+                    _integral = 0.0;
+                    brake();
+                    return true;
+                }
+                _integral = 0.0;
+                _stall_time = 0.0;
+                _stall_expected = 0.0;
+                _stall_moved = 0.0;
+                drive(0);
+                return false;
+            }
+
+            if (_following_max && (error > _following_max ||
+                                   error < -_following_max)) {
+                fault(AXISALLY_FAULT_FOLLOWING);
+                return false;
+            }
+
+            output = _kp * error + _ki * _integral;
+            if (_velocity_full > 0.0)
+                output += _profile.getVelocity() / _velocity_full;
+
+            /* Don't wind up the integral while the motor is flat out */
+            if (output > -1.0 && output < 1.0)
+                _integral += error * sec;
+            /* As drive() will; beyond that, stalled() would expect more
+             * than the motor can do
+             */
+            if (output > 1.0)
+                output = 1.0;
+            else if (output < -1.0)
+                output = -1.0;
+
+            /* Soft limits: hold at the end, don't push past it */
+            if ((output > 0.0 && here >= this->_location_max) ||
+                (output < 0.0 && here <= this->_location_min)) {
+                _integral = 0.0;
+                brake();
+                return moving;
+            }
+
+            if (_stall_window > 0.0 && stalled(output, sec)) {
+                fault(AXISALLY_FAULT_STALL);
+                return false;
+            }
+
+            drive(output);
+            return true;
+        }
+
+        /* Call from the endstop pins' change interrupt
+         *   Cuts the PWM at once if the motor is being driven onto an
+         *   endstop that is now closed; update() then faults the axis.
+         *   setSpeed() is a timer register write on the v1 shield, so
+         *   this is safe from an interrupt there. On the v2 shield it
+         *   is an I2C transfer, so leave this out and let update() poll
+         *   the pins instead. drive() checks again after each write, in
+         *   case this came in between.
+         */
+        void endstop() {
+            if (_endstop_hit || endstopAhead()) {
+                _motor->setSpeed(0);
+                _pwm_out = 0;
+                _endstop_hit = true;
+            }
+        }
+
+        /* Get the reason the axis stopped itself, if it did
+         *   One of AXISALLY_FAULT_*; update() does nothing until
+         *   clearFault().
+         */
+        int getFault() {
+            return _fault;
+        }
+
+        /* Resume, holding the current location */
+        void clearFault() {
+            _fault = AXISALLY_FAULT_NONE;
+            _endstop_hit = false;
+        }
+
+        /* Set the current location (for homing) */
+        void setLocation(int location) {
+            if (_load) {
+                /* The corrections are motor less carriage, which this
+                 * zeroes; the backlash stays as it was
+                 */
+                float shift = _encoder->read() - loadLocation();
+
+                _slack[0] -= shift;
+                _slack[1] -= shift;
+                _load->write(floorf(location / _load_ratio + 0.5));
+                _load_last = location;
+            }
+            _encoder->write(location);
+            _count = location;
+            _profile.stopAt(location);
+            this->_moveto = location;
+        }
+
+        int getLocation() {
+            if (_load)
+                return loadLocation();
+            return _encoder->read();
+        }
+
+        /* Get the measured velocity, in counts/sec */
+        float getVelocity() {
+            return _velocity;
+        }
+
+        /* Drive the motor open loop
+         *   output is -1.0 (full reverse) to 1.0 (full forward); any
+         *   non-zero output is at least the minimum PWM. 0 releases.
+         *   Once calibrated, output is a fraction of the setFullSpeed()
+         *   velocity, looked up in the PWM table.
+         */
+        void drive(float output) {
+            int pwm;
+
+            _output = output;
+            if (output == 0.0) {
+                _drive_dir = 0;
+                write(0, RELEASE);
+                return;
+            }
+
+            if (output > 1.0)
+                output = _output = 1.0;
+            else if (output < -1.0)
+                output = _output = -1.0;
+
+            if (_table.valid()) {
+                pwm = _table.pwm(output * _velocity_full);
+                if (pwm > _pwm_max)
+                    pwm = _pwm_max;
+            } else {
+                pwm = _pwm_min + fabsf(output) * (_pwm_max - _pwm_min);
+            }
+            _drive_dir = output < 0 ? -1 : 1;
+            write(pwm, output < 0 ? BACKWARD : FORWARD);
+            /* An endstop interrupt since update() checked would have
+             * been undone by that write, so check again
+             */
+            endstop();
+        }
+
+        /* Drive backwards until the endstop pin goes high (if there is
+         * one) or the encoder stops counting for 100ms, then call that
+         * location home. Blocks until done.
+         */
+        void home() {
+            unsigned long then;
+            long count, now;
+
+            /* Homing runs onto the endstop on purpose */
+            _drive_dir = 0;
+            write(_home_pwm, BACKWARD);
+
+            count = _encoder->read();
+            then = millis();
+            for (;;) {
+                if (_home_pin >= 0 && digitalRead(_home_pin))
+                    break;
+                if (millis() - then >= 100) {
+                    now = _encoder->read();
+                    if (now == count)
+                        break;
+                    count = now;
+                    then = millis();
+                }
+            }
+
+            /* Creep back off the endstop */
+            if (_home_pin >= 0) {
+                int pwm = _pwm_min;
+
+                while (digitalRead(_home_pin)) {
+                    write(pwm, FORWARD);
+                    if (pwm < _pwm_max)
+                        pwm++;
+                    delay(10);
+                }
+            }
+
+            drive(0);
+            _fault = AXISALLY_FAULT_NONE;
+            _endstop_hit = false;
+            _integral = 0.0;
+            _velocity = 0.0;
+            setLocation(_home_location);
+        }
+
+        /* Set the PWM range
+         *   pwm_min is the least PWM that still turns the motor under
+         *   load; pwm_max is the most it should ever be given.
+         */
+        void setPWMRange(int pwm_min, int pwm_max) {
+            _pwm_min = pwm_min;
+            _pwm_max = pwm_max;
+        }
+
+        /* Set the control gains
+         *   kp is output per count of error, ki output per count-second.
+         *   These are the same units PID_v1 uses with output limits of
+         *   -1..1, so PID_ATune results can be used as is.
+         */
+        void setGains(float kp, float ki) {
+            _kp = kp;
+            _ki = ki;
+            if (_adapt)
+                _adapt->begin(kp, ki, this->_velocity_max);
+        }
+
+        /* Refine the gains from here on as the motor changes (0 to
+         * stop, keeping them as they are)
+         *   Starts from the current gains, which should be tuned, and
+         *   scales the fit by the maximum velocity, so call this after
+         *   setGains() and setVelocityMax().
+         */
+        void setAdaptive(AxisAlly_GainAdapt *adapt) {
+            _adapt = adapt;
+            if (adapt)
+                adapt->begin(_kp, _ki, this->_velocity_max);
+        }
+
+        /* Set the velocity (counts/sec) at full output
+         *   Enables velocity feedforward; 0 disables it.
+         */
+        void setFullSpeed(float velocity_full) {
+            _velocity_full = velocity_full;
+        }
+
+        /* Set how close (in counts) is close enough to stop */
+        void setDeadband(int deadband) {
+            _deadband = deadband;
+        }
+
+        /* Set up stall detection
+         *   Over every window (seconds; 0 disables), the encoder must
+         *   move at least ratio times as far as the drive should have
+         *   moved it: output times the setFullSpeed() velocity, or the
+         *   planned velocity if that isn't set.
+         */
+        void setStallDetect(float window, float ratio) {
+            _stall_window = window;
+            _stall_ratio = ratio;
+        }
+
+        /* Set the most the encoder may lag the plan, in counts
+         *   0 (the default) disables the check.
+         */
+        void setFollowingMax(long following_max) {
+            _following_max = following_max;
+        }
+
+        /* Close the position loop on a carriage encoder too
+         *   ratio is motor counts per carriage count; locations are in
+         *   motor counts still, but measured at the carriage. tau is
+         *   the outer loop's time constant, in seconds: a few times
+         *   the inner loop's settling time. The carriage counts as there
+         *   within the deadband plus half a carriage count. Call before
+         *   begin().
+         */
+        void setLoadEncoder(Load *load, float ratio = 1.0, float tau = 0.5) {
+            _load = load;
+            _load_ratio = ratio;
+            _load_tau = tau;
+        }
+
+        /* Counts the motor turns between pushing the carriage one way
+         * and pushing it the other
+         *   Learnt once the carriage has been driven both ways.
+         */
+        float getBacklash() {
+            return _slack[0] - _slack[1];
+        }
+
+        /* Start from a known backlash (e.g. saved from getBacklash()),
+         * to compensate from the first reversal
+         */
+        void setBacklash(float backlash) {
+            if (_load_dir > 0)
+                _slack[1] = _slack[0] - backlash;
+            else
+                _slack[0] = _slack[1] + backlash;
+        }
+
+        /* Set up homing for begin()
+         *   pwm is the homing speed (0 for no homing), location is what
+         *   home is called afterwards, and pin is an active-high endstop
+         *   (-1 to home against a hard stop instead).
+         */
+        void setHoming(int pwm, int location, int pin = -1) {
+            _home_pwm = pwm;
+            _home_location = location;
+            _home_pin = pin;
+            if (pin >= 0)
+                pinMode(pin, INPUT_PULLUP);
+        }
+
+        /* Measure speed against PWM, both ways, and build the table
+         *   Every level is run forward, then backward, then on to
+         *   where it started, so start away from the ends; the sweep
+         *   gives up (returning false) if it leaves the location range.
+         *   Takes around 25 seconds, and sets the full speed to the
+         *   slower direction's. Blocks until done.
+         */
+        bool calibrate() {
+            unsigned char pwm[AXISALLY_PWM_SWEEP];
+            unsigned int velocity[2][AXISALLY_PWM_SWEEP];
+            long start;
+            int k, dir;
+
+            _table.clear();
+            start = _encoder->read();
+
+            for (k = 0; k < AXISALLY_PWM_SWEEP; k++) {
+                pwm[k] = (long)_pwm_max * k / (AXISALLY_PWM_SWEEP - 1);
+                for (dir = 0; dir < 2; dir++) {
+                    long speed = measure(pwm[k], dir ? BACKWARD : FORWARD);
+
+                    if (speed < 0) {
+                        drive(0);
+                        return false;
+                    }
+                    velocity[dir][k] = speed > 0xffff ? 0xffff : speed;
+                }
+
+                /* Make up for one way being faster than the other */
+                returnTo(start);
+            }
+            drive(0);
+
+            _table.build(1, pwm, velocity[0], AXISALLY_PWM_SWEEP);
+            _table.build(-1, pwm, velocity[1], AXISALLY_PWM_SWEEP);
+            if (!_table.valid())
+                return false;
+
+            _velocity_full = _table.getFullSpeed(1);
+            if (_table.getFullSpeed(-1) < _velocity_full)
+                _velocity_full = _table.getFullSpeed(-1);
+            return true;
+        }
+
+        /* Keep the calibration in EEPROM
+         *   Uses AxisAlly_PWMTable::size() bytes from address.
+         */
+        template <class Store>
+        void saveCalibration(Store &eeprom, int address) {
+            _table.save(eeprom, address);
+        }
+
+        /* Returns false if there's no calibration saved there */
+        template <class Store>
+        bool loadCalibration(Store &eeprom, int address) {
+            if (!_table.load(eeprom, address))
+                return false;
+
+            _velocity_full = _table.getFullSpeed(1);
+            if (_table.getFullSpeed(-1) < _velocity_full)
+                _velocity_full = _table.getFullSpeed(-1);
+            return true;
+        }
+
+        /* Set the endstop pins
+         *   Both are active-high, like the homing pin (which may be the
+         *   same as pin_min); -1 for none. Running onto one faults the
+         *   axis, but it can still be driven back off it.
+         */
+        void setEndstops(int pin_min, int pin_max) {
+            _endstop_min = pin_min;
+            _endstop_max = pin_max;
+            if (pin_min >= 0)
+                pinMode(pin_min, INPUT_PULLUP);
+            if (pin_max >= 0)
+                pinMode(pin_max, INPUT_PULLUP);
+        }
+
+    protected:
+        /* Set the PWM and direction, writing only what changed
+         *   On the v1 shield setSpeed() is a timer register write, but
+         *   run() shifts a byte out to the direction latch a bit at a
+         *   time; on the v2 each is an I2C transfer. Most updates
+         *   change neither.
+         */
+        void write(int pwm, int run) {
+            AXISALLY_PROFILE_SCOPE(motor_write);
+
+            if (pwm != _pwm_out) {
+                _motor->setSpeed(pwm);
+                _pwm_out = pwm;
+            }
+            if (run != _run_out) {
+                _motor->run(run);
+                _run_out = run;
+            }
+        }
+
+        /* Run at one PWM until it settles, then time it
+         *   Returns counts/sec, or -1 if it left the location range.
+         */
+        long measure(int pwm, int dir) {
+            unsigned long then;
+            long count;
+
+            write(pwm, dir);
+            delay(250);
+
+            count = _encoder->read();
+            then = millis();
+            delay(100);
+            count = _encoder->read() - count;
+            then = millis() - then;
+
+            if (!inRange(_encoder->read()))
+                return -1;
+            if (count < 0)
+                count = -count;
+            return then ? count * 1000 / (long)then : 0;
+        }
+
+        /* Carry on at the same PWM until back past start (or for 1s,
+         * in case that's too slow to move)
+         */
+        void returnTo(long start) {
+            unsigned long then = millis();
+            int dir = _encoder->read() > start ? -1 : 1;
+
+            write(_pwm_out, dir < 0 ? BACKWARD : FORWARD);
+            while (dir * (start - _encoder->read()) > 0 &&
+                   millis() - then < 1000)
+                ;
+        }
+
+        /* The carriage, in motor counts */
+        long loadLocation() {
+            return floorf(_load->read() * _load_ratio + 0.5);
+        }
+
+        /* Trim the motor's lead on the carriage, and return it for the
+         * direction of travel
+         */
+        float outerLoop(bool moving, long count, long here, float sec) {
+            float error = _profile.getLocation() - here;
+            float ahead = this->_moveto - _profile.getLocation();
+            float k = sec / _load_tau;
+            bool off = fabsf(error) > _deadband + _load_ratio / 2;
+            int i;
+
+            /* By where the move is going: the plan itself may wobble
+             * either way of zero velocity as it arrives. Once stopped,
+             * by which way the carriage is still off, if it is.
+             */
+            if (moving && ahead >= 0.5)
+                _load_dir = 1;
+            else if (moving && ahead <= -0.5)
+                _load_dir = -1;
+            else if (!moving && off)
+                _load_dir = error > 0 ? 1 : -1;
+            i = _load_dir < 0;
+            if (k > 1.0)
+                k = 1.0;
+
+            if (here != _load_last) {
+                /* The carriage moving is the motor pushing it, on the
+                 * side it moved towards: measure that side
+                 */
+                int pushed = here < _load_last;
+
+                _slack[pushed] += (count - here - _slack[pushed]) * k;
+            } else if (!moving && off && fabsf(_profile.getLocation() +
+                                               _slack[i] - count) <= _deadband) {
+                /* The motor got there but the carriage didn't, so it's
+                 * somewhere in a gap not known yet: push on
+                 */
+                _slack[i] += error * k;
+            }
+            _load_last = here;
+
+            return _slack[i];
+        }
+
+        bool inRange(long count) {
+            return count >= this->_location_min && count <= this->_location_max;
+        }
+
+        /* Is the motor being driven onto a closed endstop? */
+        bool endstopAhead() {
+            if (_drive_dir < 0 && _endstop_min >= 0)
+                return digitalRead(_endstop_min);
+            if (_drive_dir > 0 && _endstop_max >= 0)
+                return digitalRead(_endstop_max);
+            return false;
+        }
+
+        /* Stop the motor where it is, without faulting */
+        void brake() {
+            _output = 0.0;
+            _drive_dir = 0;
+            write(0, BRAKE);
+        }
+
+        /* Another tick of the stall window
+         *   Returns true if the window just closed with the motor
+         *   having moved too little.
+         */
+        bool stalled(float output, float sec) {
+            bool stall;
+            float expected;
+
+            if (_velocity_full > 0.0)
+                expected = output * _velocity_full;
+            else
+                expected = _profile.getVelocity();
+            _stall_expected += fabsf(expected) * sec;
+
+            _stall_time += sec;
+            if (_stall_time < _stall_window)
+                return false;
+
+            /* A few counts of expected motion is just noise */
+            stall = _stall_expected >= 4 &&
+                    _stall_moved < _stall_ratio * _stall_expected;
+
+            _stall_time = 0.0;
+            _stall_expected = 0.0;
+            _stall_moved = 0.0;
+
+            return stall;
+        }
+
+        /* Stop, and stay stopped until clearFault() */
+        void fault(int why) {
+            drive(0);
+            if (_adapt)
+                _adapt->restart();
+            _fault = why;
+            _integral = 0.0;
+            _stall_time = 0.0;
+            _stall_expected = 0.0;
+            _stall_moved = 0.0;
+            if (_load)
+                _load_last = loadLocation();
+            _profile.stopAt(_load ? _load_last : _count);
+            this->_moveto = _load ? _load_last : _count;
+        }
+
+        Motor *_motor;
+        Enc *_encoder;
+        Load *_load;            /* Carriage encoder, or 0 */
+        float _load_ratio;      /* Motor counts per carriage count */
+        float _load_tau;        /* Outer loop time constant, seconds */
+        int _load_dir;          /* Last planned direction, 1 or -1 */
+        long _load_last;        /* Carriage at the last update */
+        float _slack[2];        /* Motor less carriage, forward/backward */
+
+        int _pwm_min;           /* Least PWM that turns the motor */
+        int _pwm_max;           /* Most PWM allowed */
+        float _velocity_full;   /* Counts/sec at full output */
+        float _kp, _ki;         /* Control gains */
+        long _deadband;         /* Counts from target that count as there */
+
+        int _home_pwm;          /* Homing speed, 0 for no homing */
+        int _home_location;     /* Location of home */
+        int _home_pin;          /* Endstop pin, or -1 */
+
+        int _endstop_min;       /* Endstop pins, or -1 */
+        int _endstop_max;
+        volatile bool _endstop_hit;     /* Set by endstop() */
+        volatile int _drive_dir;        /* Direction driven, or 0 */
+
+        volatile int _pwm_out;  /* Last written to the motor, or -1 */
+        int _run_out;
+
+        long _count;            /* Encoder count at the last update */
+        float _velocity;        /* Measured counts/sec */
+        float _integral;        /* Integrated error, count-seconds */
+        float _output;          /* Driven since the last update */
+        AxisAlly_GainAdapt *_adapt;     /* Or 0 */
+
+        int _fault;             /* AXISALLY_FAULT_* */
+        long _following_max;    /* Most counts behind the plan, or 0 */
+        float _stall_window;    /* Seconds per stall check, or 0 */
+        float _stall_ratio;     /* Least fraction of expected motion */
+        float _stall_time;      /* Seconds into this window */
+        float _stall_expected;  /* Counts the drive should have moved */
+        float _stall_moved;     /* Counts the encoder did move */
+
+        AxisAlly_PWMTable _table;       /* Valid once calibrated */
+
+        AxisAlly_SimStatic _profile;
+};
+
+/* The same, behind an AxisAlly pointer */
+template <class Motor, class Enc, class Load = Enc>
+class AxisAlly_DCEncoder :
+        public AxisAlly_Virtual<AxisAlly_DCEncoderStatic<Motor, Enc, Load> > {
+    public:
+        AxisAlly_DCEncoder(Motor *motor, Enc *encoder) :
+            AxisAlly_Virtual<AxisAlly_DCEncoderStatic<Motor, Enc, Load> >(motor, encoder) { }
+};
+
+#endif /* AXISALLY_DCENCODER_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,377 @@
+/*
+ * Quadrature decoder with a glitch filter
+ *
+ * Decodes like the PJRC Encoder library: every change of the two pins
+ * is a count, and a change of both at once (an edge missed) is taken
+ * as two counts forward. On its own that counts noise too: motor PWM
+ * coupling into an encoder line gives a count and its reverse a few
+ * microseconds apart, which the PID then chases.
+ *
+ * With setFilter(dwell_us), a new pin state only counts once it has
+ * held for dwell_us. One that reverts sooner is a glitch, and is
+ * dropped (see glitches()). The cost is speed: edges closer together
+ * than dwell_us are lost too, two at a time, so the fastest it can
+ * track is 1/dwell_us edges per second - 50000 for 20us, which at 4
+ * counts per line of a 500 line disc is 1500rpm. See encbench.cpp for
+ * the cost per sample, with and without.
+ *
+ * A state that has held long enough is counted at the next sample(),
+ * so call it from the pins' change interrupts and before reading: the
+ * next interrupt says how long the last state held. AxisAlly_Encoder
+ * reads two pins on the Arduino, and samples in read() and update();
+ * call update() from the pins' change interrupts. It takes the place of
+ * Encoder in AxisAlly_DCEncoder.
+ *
+ * Polled instead, with no interrupts, a state seen once could have
+ * reverted straight after, so setFilter(dwell_us, true) only counts a
+ * state once a sample at least dwell_us after it was first seen still
+ * sees it. Then every state has to be sampled twice, dwell_us apart,
+ * so polling has to be at least twice as fast as the edges come.
+ *
+ * On a rotary axis, setRevolution() gives the counts per turn, and
+ * index() is called from the interrupt of the encoder's index pulse,
+ * once a turn. That latches the count there as the origin, so angle()
+ * and revolutions() are measured from the last index rather than from
+ * power-on: a count gained or lost on the way only lasts until the
+ * next index, and drift() says by how much it was out.
+ *
+ * At low speed a count is coarse feedback: a controller holding a
+ * position sees the count flick between two values as the disc sits
+ * on an edge, and drives back and forth after it. position() is finer.
+ * It puts each edge halfway between the counts either side, so a
+ * count flicking over one edge reads as that edge, and between edges
+ * moves on at the rate the last two came, up to the next one. It never
+ * strays more than half a count from count().
+ */
+
+#ifndef AXISALLY_ENCODER_H
+#define AXISALLY_ENCODER_H
+
+/* Pins as bit 0 for A, bit 1 for B */
+class AxisAlly_QuadDecoder {
+    public:
+        AxisAlly_QuadDecoder() {
+            _count = 0;
+            _state = 0;
+            _pending = 0;
+            _since = 0;
+            _dwell = 0;
+            _polled = false;
+            _glitches = 0;
+
+            _edge_us = 0;
+            _interval = 0;
+            _edge_dir = 0;
+
+            _revolution = 0;
+            _origin = 0;
+            _turns = 0;
+            _drift = 0;
+            _indexed = false;
+        }
+
+        /* Where the pins are to start with */
+        void begin(unsigned char pins) {
+            _state = pins & 3;
+            _pending = _state;
+        }
+
+        /* Least time a new pin state must hold to count; 0 for none
+         *   polled if sample() isn't called on every pin change.
+         */
+        void setFilter(unsigned int dwell_us, bool polled = false) {
+            _dwell = dwell_us;
+            _polled = polled;
+        }
+
+        /* The pins, now */
+        void sample(unsigned char pins, unsigned long now_us) {
+            pins &= 3;
+
+            /* Whatever was pending held long enough to count; polled,
+             * only if it is still there
+             */
+            if (_pending != _state && now_us - _since >= _dwell &&
+                (!_polled || pins == _pending))
+                decode(_pending, _since);
+
+            if (pins == _pending)
+                return;
+            /* Replaced before it counted */
+            if (_pending != _state)
+                _glitches++;
+            _pending = pins;
+            _since = now_us;
+
+            if (!_dwell)
+                decode(pins, now_us);
+        }
+
+        long count() {
+            return _count;
+        }
+
+        void setCount(long count) {
+            _count = count;
+            _edge_dir = 0;
+        }
+
+        /* Position at now_us, in counts, interpolated between edges */
+        float position(unsigned long now_us) {
+            float fraction = 0.0;
+
+            if (!_edge_dir)
+                return _count;
+            if (_interval) {
+                fraction = (float)(now_us - _edge_us) / _interval;
+                if (fraction > 1.0)
+                    fraction = 1.0;
+            }
+
+            return _count + _edge_dir * (fraction - 0.5f);
+        }
+
+        /* Counts per second at now_us, from the time between edges
+         *   0 until two edges have come the same way; falls off if the
+         *   next is later than the last interval.
+         */
+        float velocity(unsigned long now_us) {
+            unsigned long interval = _interval;
+
+            if (!interval)
+                return 0.0;
+            if (now_us - _edge_us > interval)
+                interval = now_us - _edge_us;
+
+            return _edge_dir * 1000000.0 / interval;
+        }
+
+        /* Pin changes dropped by the filter */
+        unsigned long glitches() {
+            return _glitches;
+        }
+
+        /* Counts per turn, on a rotary axis */
+        void setRevolution(long counts) {
+            _revolution = counts;
+        }
+
+        /* At the index pulse
+         *   The count here becomes the origin. Every index after the
+         *   first should be a whole number of turns from the last; the
+         *   difference is kept for drift(). Latched on the same edge of
+         *   the pulse both ways round, so the origin shifts by the
+         *   pulse's width with the direction of travel.
+         */
+        void index() {
+            long turns;
+
+            if (!_revolution)
+                return;
+
+            if (_indexed) {
+                /* Nearest whole turn */
+                turns = floorDiv(_count - _origin + _revolution / 2, _revolution);
+                _drift = _count - _origin - turns * _revolution;
+                _turns += turns;
+            }
+            _origin = _count;
+            _indexed = true;
+        }
+
+        /* Has index() been called yet? */
+        bool indexed() {
+            return _indexed;
+        }
+
+        /* Counts into the turn, from 0 at the index to setRevolution() - 1
+         *   Before the first index, from where the count started.
+         */
+        long angle() {
+            if (!_revolution)
+                return _count;
+            return _count - _origin - floorDiv(_count - _origin, _revolution) * _revolution;
+        }
+
+        /* Whole turns, from the start of the first after an index
+         *   Before the first index, from where the count started.
+         */
+        long revolutions() {
+            if (!_revolution)
+                return 0;
+            return _turns + floorDiv(_count - _origin, _revolution);
+        }
+
+        /* How many counts the last index was away from a whole turn
+         * after the one before: counts gained (or, if negative, lost)
+         */
+        long drift() {
+            return _drift;
+        }
+
+    private:
+        /* Rounding down, for negative counts too */
+        static long floorDiv(long a, long b) {
+            long q = a / b;
+
+            return (a % b && (a < 0) != (b < 0)) ? q - 1 : q;
+        }
+
+        void decode(unsigned char pins, unsigned long now_us) {
+            /* By new << 2 | old, as in Encoder.h */
+            static const signed char delta[16] = {
+                0, 1, -1, 2, -1, 0, -2, 1, 1, -2, 0, -1, 2, -1, 1, 0
+            };
+            int counts = delta[pins << 2 | _state];
+            signed char dir = counts < 0 ? -1 : 1;
+
+            _count += counts;
+            _state = pins;
+            if (!counts)
+                return;
+
+            /* Time per count, only while going the same way */
+            if (dir == _edge_dir)
+                _interval = (now_us - _edge_us) / (counts * dir);
+            else
+                _interval = 0;
+            _edge_us = now_us;
+            _edge_dir = dir;
+        }
+
+        long _count;
+        unsigned char _state;           /* Pins as counted */
+        unsigned char _pending;         /* Pins last seen */
+        unsigned long _since;           /* When _pending was first seen */
+        unsigned int _dwell;
+        bool _polled;                   /* Not sampled on every change */
+        unsigned long _glitches;
+
+        unsigned long _edge_us;         /* When the last count was */
+        unsigned long _interval;        /* Before that, per count, or 0 */
+        signed char _edge_dir;          /* Its direction, or 0 for none */
+
+        long _revolution;               /* Counts per turn, or 0 */
+        long _origin;                   /* Count at the last index */
+        long _turns;                    /* revolutions() at _origin */
+        long _drift;
+        bool _indexed;
+};
+
+#ifdef ARDUINO
+/* On two pins, read directly from the port
+ *   Call update() from a change interrupt on either or both pins; as
+ *   with Encoder, a pin without one is still picked up at the next
+ *   interrupt or read(), as a double step if both have changed. With
+ *   a filter, a pin without one leaves it unable to tell a glitch from
+ *   an edge, so give both pins one or set the filter polled.
+ */
+class AxisAlly_Encoder : public AxisAlly_QuadDecoder {
+    public:
+        AxisAlly_Encoder(int pin_a, int pin_b, unsigned int dwell_us = 0) {
+            pinMode(pin_a, INPUT_PULLUP);
+            pinMode(pin_b, INPUT_PULLUP);
+            _reg_a = portInputRegister(digitalPinToPort(pin_a));
+            _reg_b = portInputRegister(digitalPinToPort(pin_b));
+            _mask_a = digitalPinToBitMask(pin_a);
+            _mask_b = digitalPinToBitMask(pin_b);
+
+            setFilter(dwell_us);
+            /* Let the pull-ups charge any R-C filter on the pins, as
+             * Encoder does, so the first state read is the real one
+             */
+            delayMicroseconds(2000);
+            begin(pins());
+        }
+
+        void update() {
+            sample(pins(), micros());
+        }
+
+        long read() {
+            long count;
+
+            noInterrupts();
+            update();
+            count = this->count();
+            interrupts();
+
+            return count;
+        }
+
+        void write(long count) {
+            noInterrupts();
+            setCount(count);
+            interrupts();
+        }
+
+        /* Call from the index pin's interrupt, on its rising edge */
+        void index() {
+            update();
+            AxisAlly_QuadDecoder::index();
+        }
+
+        long angle() {
+            long angle;
+
+            noInterrupts();
+            update();
+            angle = AxisAlly_QuadDecoder::angle();
+            interrupts();
+
+            return angle;
+        }
+
+        long revolutions() {
+            long turns;
+
+            noInterrupts();
+            update();
+            turns = AxisAlly_QuadDecoder::revolutions();
+            interrupts();
+
+            return turns;
+        }
+
+        float position() {
+            unsigned long now = micros();
+            float position;
+
+            noInterrupts();
+            update();
+            position = AxisAlly_QuadDecoder::position(now);
+            interrupts();
+
+            return position;
+        }
+
+        float velocity() {
+            unsigned long now = micros();
+            float velocity;
+
+            noInterrupts();
+            update();
+            velocity = AxisAlly_QuadDecoder::velocity(now);
+            interrupts();
+
+            return velocity;
+        }
+
+    private:
+        unsigned char pins() {
+            return ((*_reg_a & _mask_a) ? 1 : 0) | ((*_reg_b & _mask_b) ? 2 : 0);
+        }
+
+        volatile unsigned char *_reg_a, *_reg_b;
+        unsigned char _mask_a, _mask_b;
+};
+
+/* AxisAlly_DCEncoder's feedback: interpolated */
+inline float axisally_position(AxisAlly_Encoder *encoder, long count)
+{
+    return encoder->position();
+}
+#endif
+
+#endif /* AXISALLY_ENCODER_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,235 @@
+/*
+ * Character LCD on a PCF8574 I2C backpack, updated a little at a time
+ *
+ * An HD44780 in 4-bit mode behind a PCF8574 takes four I2C bytes per
+ * character (two nibbles, each strobed on EN), so redrawing a 20x4
+ * screen is some 350 bytes: 30ms at 100KHz, far longer than a control
+ * tick. Here setCursor() and print() only write a copy of the screen
+ * in RAM. Each update() compares that against what the display
+ * already shows and sends just the cells that differ, and no more than
+ * a few of them (setBudget()), as a single I2C transfer. A screen of
+ * live numbers costs a handful of changed digits per tick.
+ *
+ * Bus is TwoWire or AxisAlly_TWIQueue (at a low priority, so motor
+ * commands go first). The backpack wiring is given as PCF8574 bit
+ * numbers, with D4..D7 on four bits in a row.
+ */
+
+#ifndef AXISALLY_LCD_H
+#define AXISALLY_LCD_H
+
+#define AXISALLY_LCD_COLS       20
+#define AXISALLY_LCD_ROWS       4
+
+/* HD44780 commands */
+#define AXISALLY_LCD_CLEAR      0x01
+#define AXISALLY_LCD_ENTRY      0x06    /* Left to right, no shift */
+#define AXISALLY_LCD_DISPLAY    0x0c    /* On, no cursor, no blink */
+#define AXISALLY_LCD_FUNCTION   0x28    /* 4-bit, 2 line, 5x8 */
+#define AXISALLY_LCD_DDRAM      0x80    /* | address */
+
+template <class Bus>
+class AxisAlly_LCD {
+    public:
+        /* en, rw, rs, d4 and backlight are PCF8574 bits; backlight_low
+         * if the backlight is on when its bit is low
+         */
+        AxisAlly_LCD(Bus *bus, int address, int en, int rw, int rs, int d4,
+                     int backlight, bool backlight_low) {
+            _bus = bus;
+            _address = address;
+            _en = 1 << en;
+            _rs = 1 << rs;
+            _d4 = d4;
+            _backlight_bit = 1 << backlight;
+            _backlight_low = backlight_low;
+            (void)rw;               /* Only ever written, so held low */
+
+            _budget = 4;
+            _col = 0;
+            _row = 0;
+            _shown_at = -1;
+            setBacklight(true);
+            clear();
+            for (int r = 0; r < AXISALLY_LCD_ROWS; r++)
+                for (int c = 0; c < AXISALLY_LCD_COLS; c++)
+                    _shown[r][c] = ' ';
+        }
+
+        /* Reset the display into 4-bit mode and clear it. Blocks for
+         * about 60ms, as the HD44780 needs.
+         */
+        void begin() {
+            delay(50);
+
+            /* Whatever mode it was in, three 8-bit function sets get it
+             * into 8-bit mode; then one more (as one nibble) to 4-bit
+             */
+            _bus->beginTransmission(_address);
+            nibble(0x3, false);
+            _bus->endTransmission();
+            delay(5);
+            _bus->beginTransmission(_address);
+            nibble(0x3, false);
+            _bus->endTransmission();
+            delayMicroseconds(150);
+            _bus->beginTransmission(_address);
+            nibble(0x3, false);
+            nibble(0x2, false);
+            send(AXISALLY_LCD_FUNCTION, false);
+            send(AXISALLY_LCD_DISPLAY, false);
+            send(AXISALLY_LCD_CLEAR, false);
+            _bus->endTransmission();
+            delay(2);
+            _bus->beginTransmission(_address);
+            send(AXISALLY_LCD_ENTRY, false);
+            _bus->endTransmission();
+
+            /* It's blank now, whatever it showed before */
+            for (int r = 0; r < AXISALLY_LCD_ROWS; r++)
+                for (int c = 0; c < AXISALLY_LCD_COLS; c++)
+                    _shown[r][c] = ' ';
+            _shown_at = -1;
+        }
+
+        /* Blank the copy; the display follows over the next updates */
+        void clear() {
+            for (int r = 0; r < AXISALLY_LCD_ROWS; r++)
+                for (int c = 0; c < AXISALLY_LCD_COLS; c++)
+                    _want[r][c] = ' ';
+            _col = 0;
+            _row = 0;
+        }
+
+        void setCursor(int col, int row) {
+            _col = col;
+            _row = row;
+        }
+
+        /* Write into the copy at the cursor; nothing wraps */
+        void print(const char *text) {
+            while (*text) {
+                if (_row < AXISALLY_LCD_ROWS && _col < AXISALLY_LCD_COLS)
+                    _want[_row][_col] = *text;
+                _col++;
+                text++;
+            }
+        }
+
+        /* A number, right-aligned in width columns (if non-zero), so a
+         * shorter number doesn't leave old digits behind
+         */
+        void print(long value, int width = 0) {
+            char text[12];
+            int i = sizeof(text) - 1;
+            bool negative = value < 0;
+            unsigned long magnitude = negative ? -(unsigned long)value : value;
+
+            text[i] = 0;
+            do {
+                text[--i] = '0' + magnitude % 10;
+                magnitude /= 10;
+            } while (magnitude);
+            if (negative)
+                text[--i] = '-';
+            while (width > (int)sizeof(text) - 1 - i && i > 0)
+                text[--i] = ' ';
+
+            print(text + i);
+        }
+
+        void setBacklight(bool on) {
+            _backlight = (on != _backlight_low) ? _backlight_bit : 0;
+        }
+
+        /* Most cells update() may send (a cursor move counts as one)
+         *   At most 7, which is what fits in a 32 byte I2C buffer. The
+         *   first change always goes out, even when it needs a cursor
+         *   move that takes it over.
+         */
+        void setBudget(int cells) {
+            _budget = cells < 1 ? 1 : cells > 7 ? 7 : cells;
+        }
+
+        /* Send some of what changed
+         *   Returns true if there is more to send.
+         */
+        bool update() {
+            int sent = 0;
+            bool open = false;
+
+            for (int r = 0; r < AXISALLY_LCD_ROWS; r++) {
+                for (int c = 0; c < AXISALLY_LCD_COLS; c++) {
+                    int at = r * AXISALLY_LCD_COLS + c;
+
+                    if (_want[r][c] == _shown[r][c])
+                        continue;
+                    if (sent && sent + (at != _shown_at) >= _budget) {
+                        if (open)
+                            _bus->endTransmission();
+                        return true;
+                    }
+
+                    if (!open) {
+                        _bus->beginTransmission(_address);
+                        open = true;
+                    }
+                    /* The address counter moves on by itself, within a
+                     * row; anywhere else needs setting
+                     */
+                    if (at != _shown_at) {
+                        send(AXISALLY_LCD_DDRAM | ddram(r, c), false);
+                        sent++;
+                    }
+                    send(_want[r][c], true);
+                    sent++;
+                    _shown[r][c] = _want[r][c];
+                    _shown_at = (c + 1 < AXISALLY_LCD_COLS) ? at + 1 : -1;
+                }
+            }
+
+            if (open)
+                _bus->endTransmission();
+            return false;
+        }
+
+    private:
+        /* Rows 2 and 3 carry on from the ends of rows 0 and 1 */
+        static int ddram(int row, int col) {
+            static const unsigned char rows[AXISALLY_LCD_ROWS] = {
+                0x00, 0x40, 0x14, 0x54
+            };
+
+            return rows[row] + col;
+        }
+
+        void send(int value, bool data) {
+            nibble(value >> 4, data);
+            nibble(value, data);
+        }
+
+        /* One nibble, strobed on EN's falling edge */
+        void nibble(int value, bool data) {
+            int out = ((value & 0xf) << _d4) | (data ? _rs : 0) | _backlight;
+
+            _bus->write(out | _en);
+            _bus->write(out);
+        }
+
+        Bus *_bus;
+        int _address;
+        int _en, _rs, _d4;              /* Backpack wiring */
+        int _backlight_bit;
+        bool _backlight_low;
+        int _backlight;                 /* To OR into every write */
+
+        int _budget;                    /* Cells per update() */
+        int _col, _row;                 /* print() cursor */
+        int _shown_at;                  /* Display's address counter, as
+                                         * row * cols + col, or -1 */
+        char _want[AXISALLY_LCD_ROWS][AXISALLY_LCD_COLS];
+        char _shown[AXISALLY_LCD_ROWS][AXISALLY_LCD_COLS];
+};
+
+#endif /* AXISALLY_LCD_H */
+/* vim: set shiftwidth=4 expandtab:  */
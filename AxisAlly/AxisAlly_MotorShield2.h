@@ -0,0 +1,225 @@
+/*
+ * Batched output to the Adafruit Motor Shield v2
+ *
+ * The v2 shield drives its motors from a PCA9685 PWM chip on I2C.
+ * Adafruit_DCMotor writes the chip as soon as it is told anything: one
+ * transfer for setSpeed(), two for run(), at the 100KHz the Wire
+ * library starts at. These motors keep a copy of the chip's output
+ * registers instead, and between hold() and flush() only change the
+ * copy; flush() then sends every channel that changed in one
+ * auto-increment burst (two if they don't fit in the Wire buffer).
+ * Outside hold(), each setSpeed() or run() is sent on its own, but
+ * still only if it changed something, so blocking code like homing
+ * works unchanged.
+ *
+ * Bus is TwoWire, or anything with its beginTransmission(), write()
+ * and endTransmission(), like AxisAlly_TWIQueue. The motors are
+ * AxisAlly_DCEncoder-ready: setSpeed(0..255) and
+ * run(FORWARD/BACKWARD/BRAKE/RELEASE).
+ */
+
+#ifndef AXISALLY_MOTORSHIELD2_H
+#define AXISALLY_MOTORSHIELD2_H
+
+/* Adafruit's run() commands, for sketches without its library */
+#ifndef FORWARD
+#define FORWARD         1
+#define BACKWARD        2
+#define BRAKE           3
+#define RELEASE         4
+#endif
+
+#define AXISALLY_PCA9685_MODE1          0x00
+#define AXISALLY_PCA9685_LED0           0x06    /* ON_L, ON_H, OFF_L, OFF_H */
+#define AXISALLY_PCA9685_PRESCALE       0xfe
+
+#define AXISALLY_PCA9685_SLEEP          0x10
+#define AXISALLY_PCA9685_AI             0x20    /* Auto-increment */
+#define AXISALLY_PCA9685_RESTART        0x80
+
+/* Channels per burst: 4 register bytes each, plus the register
+ * address, in the Wire library's 32 byte buffer
+ */
+#define AXISALLY_PCA9685_BURST          7
+
+template <class Bus> class AxisAlly_MotorShield2;
+
+/* One of the shield's DC motor outputs */
+template <class Bus>
+class AxisAlly_MotorShield2DC {
+    public:
+        AxisAlly_MotorShield2DC() {
+            _shield = 0;
+        }
+
+        void setSpeed(int speed) {
+            _shield->setChannel(_pwm, speed * 16);
+            _shield->send();
+        }
+
+        void run(int cmd) {
+            switch (cmd) {
+            case FORWARD:
+                _shield->setChannel(_in2, 0);
+                _shield->setChannel(_in1, 4096);
+                break;
+            case BACKWARD:
+                _shield->setChannel(_in1, 0);
+                _shield->setChannel(_in2, 4096);
+                break;
+            case BRAKE:
+                _shield->setChannel(_in1, 4096);
+                _shield->setChannel(_in2, 4096);
+                break;
+            case RELEASE:
+                _shield->setChannel(_in1, 0);
+                _shield->setChannel(_in2, 0);
+                break;
+            }
+            _shield->send();
+        }
+
+    private:
+        friend class AxisAlly_MotorShield2<Bus>;
+
+        AxisAlly_MotorShield2<Bus> *_shield;
+        int _pwm, _in1, _in2;   /* PCA9685 channels */
+};
+
+template <class Bus>
+class AxisAlly_MotorShield2 {
+    public:
+        AxisAlly_MotorShield2(Bus *bus, int address = 0x60) {
+            /* PWM, IN2, IN1 channels for M1..M4, as the shield is wired */
+            static const unsigned char pins[4][3] = {
+                { 8, 9, 10 }, { 13, 12, 11 }, { 2, 3, 4 }, { 7, 6, 5 },
+            };
+
+            _bus = bus;
+            _address = address;
+            _held = false;
+            _dirty = 0;
+            for (int i = 0; i < 16; i++)
+                _value[i] = 0;
+
+            for (int n = 0; n < 4; n++) {
+                _motor[n]._shield = this;
+                _motor[n]._pwm = pins[n][0];
+                _motor[n]._in2 = pins[n][1];
+                _motor[n]._in1 = pins[n][2];
+            }
+        }
+
+        /* Set up the chip, and release every motor
+         *   pwm_hz is the motor PWM frequency (the chip manages 24 to
+         *   1526Hz), and i2c_hz the bus clock: the PCA9685 is good for
+         *   1MHz, but what the wiring manages is another matter, so
+         *   check with MultiSpeedI2CScanner.
+         */
+        void begin(float pwm_hz = 1500, unsigned long i2c_hz = 400000) {
+            int prescale;
+
+#ifdef TWBR
+            TWBR = (F_CPU / i2c_hz - 16) / 2;
+#else
+            (void)i2c_hz;
+#endif
+
+            prescale = 25000000.0 / 4096 / pwm_hz - 1 + 0.5;
+            if (prescale < 3)
+                prescale = 3;
+            else if (prescale > 255)
+                prescale = 255;
+
+            /* The prescaler can only be set while asleep */
+            writeRegister(AXISALLY_PCA9685_MODE1, AXISALLY_PCA9685_SLEEP);
+            writeRegister(AXISALLY_PCA9685_PRESCALE, prescale);
+            writeRegister(AXISALLY_PCA9685_MODE1, 0);
+            delay(1);
+            writeRegister(AXISALLY_PCA9685_MODE1,
+                          AXISALLY_PCA9685_RESTART | AXISALLY_PCA9685_AI);
+
+            /* Write every motor channel, so the copy matches the chip */
+            hold();
+            for (int n = 0; n < 4; n++) {
+                _motor[n].setSpeed(0);
+                _motor[n].run(RELEASE);
+                _dirty |= (1U << _motor[n]._pwm) | (1U << _motor[n]._in1) |
+                          (1U << _motor[n]._in2);
+            }
+            flush();
+        }
+
+        /* DC motor n, 1 to 4 */
+        AxisAlly_MotorShield2DC<Bus> *getMotor(int n) {
+            return &_motor[n - 1];
+        }
+
+        /* Collect motor changes until flush() */
+        void hold() {
+            _held = true;
+        }
+
+        /* Send every change since hold(), and stop holding */
+        void flush() {
+            _held = false;
+            send();
+        }
+
+        /* Set a channel's duty, 0 to 4095 of 4096, or 4096 for fully on */
+        void setChannel(int channel, unsigned int value) {
+            if (_value[channel] == value)
+                return;
+            _value[channel] = value;
+            _dirty |= 1U << channel;
+        }
+
+        /* Send the changed channels, unless holding */
+        void send() {
+            while (_dirty && !_held) {
+                int first, last, end;
+
+                for (first = 0; !(_dirty & (1U << first)); first++)
+                    ;
+                end = first + AXISALLY_PCA9685_BURST;
+                if (end > 16)
+                    end = 16;
+                for (last = end - 1; !(_dirty & (1U << last)); last--)
+                    ;
+
+                /* Clean channels in between go too; still one burst */
+                _bus->beginTransmission(_address);
+                _bus->write(AXISALLY_PCA9685_LED0 + 4 * first);
+                for (int i = first; i <= last; i++) {
+                    unsigned int on = _value[i] > 4095 ? 4096 : 0;
+                    unsigned int off = _value[i] > 4095 ? 0 : _value[i];
+
+                    _bus->write(on & 0xff);
+                    _bus->write(on >> 8);
+                    _bus->write(off & 0xff);
+                    _bus->write(off >> 8);
+                    _dirty &= ~(1U << i);
+                }
+                _bus->endTransmission();
+            }
+        }
+
+    private:
+        void writeRegister(int reg, int value) {
+            _bus->beginTransmission(_address);
+            _bus->write(reg);
+            _bus->write(value);
+            _bus->endTransmission();
+        }
+
+        Bus *_bus;
+        int _address;
+        bool _held;             /* Between hold() and flush() */
+        unsigned int _dirty;    /* Channels changed since last sent */
+        unsigned int _value[16];        /* As last set, per channel */
+
+        AxisAlly_MotorShield2DC<Bus> _motor[4];
+};
+
+#endif /* AXISALLY_MOTORSHIELD2_H */
+/* vim: set shiftwidth=4 expandtab:  */
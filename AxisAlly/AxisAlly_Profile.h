@@ -0,0 +1,276 @@
+/*
+ * Profiling hooks
+ *
+ * Marks a piece of code as a named section, and keeps the run count,
+ * min/avg/max time and a histogram of how long it took, in RAM, to be
+ * dumped on request:
+ *
+ *   void readNextPosition() {
+ *       AXISALLY_PROFILE_SCOPE(serial);        // To the end of the block
+ *       ...
+ *   }
+ *
+ *   AXISALLY_PROFILE_ENTER(read);              // Or between two points
+ *   count = encoder.read();
+ *   AXISALLY_PROFILE_EXIT(read);
+ *
+ *   AXISALLY_PROFILE_SETUP();                  // In setup()
+ *   AXISALLY_PROFILE_DUMP(Serial);             // Then when asked
+ *
+ * All of it compiles to nothing unless AXISALLY_PROFILE is defined
+ * (e.g. CPPFLAGS += -DAXISALLY_PROFILE), so the hooks can stay in.
+ *
+ * Times are in clock ticks. On the ATmega that is CPU cycles, from a
+ * 16-bit timer run at the CPU clock (Timer5 on the Mega, else Timer1;
+ * define AXISALLY_PROFILE_TIMER to pick another if the sketch needs
+ * that one), so a section over 4ms at 16MHz wraps. On the host it's
+ * nanoseconds from std::chrono, or with AXISALLY_PROFILE_RDTSC the x86
+ * time stamp counter. AXISALLY_PROFILE_CLOCK overrides all of these,
+ * for a simulated clock.
+ *
+ * The histogram has a bucket per power of two: bucket n counts runs of
+ * 2^n up to 2^(n+1) ticks, and the last bucket everything longer. A
+ * section gets listed from its first run.
+ */
+
+#ifndef AXISALLY_PROFILE_H
+#define AXISALLY_PROFILE_H
+
+#ifdef AXISALLY_PROFILE
+
+#define AXISALLY_PROFILE_BUCKETS        16
+
+#if defined(AXISALLY_PROFILE_CLOCK)
+/* Supplied by the includer */
+#elif defined(__AVR__)
+#ifndef AXISALLY_PROFILE_TIMER
+#ifdef TCCR5B
+#define AXISALLY_PROFILE_TIMER  5
+#else
+#define AXISALLY_PROFILE_TIMER  1
+#endif
+#endif
+
+/* The timer's registers, e.g. TCNT5; the extra level expands the number */
+#define AXISALLY_PROFILE_REG__(name, n, suffix) name##n##suffix
+#define AXISALLY_PROFILE_REG_(name, n, suffix)  AXISALLY_PROFILE_REG__(name, n, suffix)
+#define AXISALLY_PROFILE_REG(name, suffix) \
+    AXISALLY_PROFILE_REG_(name, AXISALLY_PROFILE_TIMER, suffix)
+
+/* A 16-bit timer, free running at the CPU clock */
+struct AxisAlly_ProfileClock {
+    typedef unsigned int ticks;
+
+    static void setup() {
+        AXISALLY_PROFILE_REG(TCCR, A) = 0;
+        AXISALLY_PROFILE_REG(TCCR, B) = _BV(AXISALLY_PROFILE_REG(CS, 0));
+    }
+
+    static ticks now() {
+        return AXISALLY_PROFILE_REG(TCNT, );
+    }
+
+    static unsigned long perMicro() {
+        return F_CPU / 1000000;
+    }
+};
+#define AXISALLY_PROFILE_CLOCK  AxisAlly_ProfileClock
+#elif defined(AXISALLY_PROFILE_RDTSC)
+#include <x86intrin.h>
+#include <chrono>
+
+/* The time stamp counter, calibrated against std::chrono at setup() */
+struct AxisAlly_ProfileClock {
+    typedef unsigned long ticks;
+
+    static void setup() {
+        std::chrono::steady_clock::time_point start, end;
+        unsigned long long tsc;
+
+        start = std::chrono::steady_clock::now();
+        tsc = __rdtsc();
+        do {
+            end = std::chrono::steady_clock::now();
+        } while (end - start < std::chrono::milliseconds(10));
+        rate() = (__rdtsc() - tsc) /
+                 std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    }
+
+    static ticks now() {
+        return __rdtsc();
+    }
+
+    static unsigned long perMicro() {
+        return rate();
+    }
+
+    static unsigned long &rate() {
+        static unsigned long per_us = 0;        /* Until setup() */
+        return per_us;
+    }
+};
+#define AXISALLY_PROFILE_CLOCK  AxisAlly_ProfileClock
+#else
+#include <chrono>
+
+/* Nanoseconds */
+struct AxisAlly_ProfileClock {
+    typedef unsigned long ticks;
+
+    static void setup() {
+    }
+
+    static ticks now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static unsigned long perMicro() {
+        return 1000;
+    }
+};
+#define AXISALLY_PROFILE_CLOCK  AxisAlly_ProfileClock
+#endif
+
+/* One named section's timings */
+class AxisAlly_ProfileSection {
+    public:
+        typedef AXISALLY_PROFILE_CLOCK Clock;
+
+        AxisAlly_ProfileSection(const char *name) {
+            _name = name;
+            reset();
+            _next = first();
+            first() = this;
+        }
+
+        void record(unsigned long ticks) {
+            unsigned long t = ticks;
+            int bucket = 0;
+
+            _count++;
+            _sum += ticks;
+            if (ticks < _min || _count == 1)
+                _min = ticks;
+            if (ticks > _max)
+                _max = ticks;
+
+            while (t > 1 && bucket < AXISALLY_PROFILE_BUCKETS - 1) {
+                t >>= 1;
+                bucket++;
+            }
+            /* Saturate rather than wrap */
+            if (_histogram[bucket] != (unsigned int)-1)
+                _histogram[bucket]++;
+        }
+
+        void reset() {
+            _count = 0;
+            _sum = 0;
+            _min = 0;
+            _max = 0;
+            for (int i = 0; i < AXISALLY_PROFILE_BUCKETS; i++)
+                _histogram[i] = 0;
+        }
+
+        const char *name() { return _name; }
+        unsigned long count() { return _count; }
+        unsigned long shortest() { return _min; }
+        unsigned long longest() { return _max; }
+        unsigned long average() { return _count ? _sum / _count : 0; }
+        unsigned int bucket(int n) { return _histogram[n]; }
+        AxisAlly_ProfileSection *next() { return _next; }
+
+        /* Every section that has run, most recently added first */
+        static AxisAlly_ProfileSection *&first() {
+            static AxisAlly_ProfileSection *list = 0;
+            return list;
+        }
+
+        static void resetAll() {
+            for (AxisAlly_ProfileSection *s = first(); s; s = s->_next)
+                s->reset();
+        }
+
+        /* To Serial, or anything with its print()s:
+         *   name runs min avg max: bucket 0 .. bucket 15
+         */
+        template <class Out>
+        static void dump(Out &out) {
+            out.print("profile ticks/us ");
+            out.print((unsigned long)Clock::perMicro());
+            out.print("\r\n");
+            for (AxisAlly_ProfileSection *s = first(); s; s = s->_next) {
+                out.print(s->_name);
+                out.print(" ");
+                out.print(s->_count);
+                out.print(" ");
+                out.print(s->_min);
+                out.print(" ");
+                out.print(s->average());
+                out.print(" ");
+                out.print(s->_max);
+                out.print(":");
+                for (int i = 0; i < AXISALLY_PROFILE_BUCKETS; i++) {
+                    out.print(" ");
+                    out.print((unsigned long)s->_histogram[i]);
+                }
+                out.print("\r\n");
+            }
+        }
+
+    private:
+        const char *_name;
+        AxisAlly_ProfileSection *_next;
+        unsigned long _count;
+        unsigned long _sum;
+        unsigned long _min, _max;
+        unsigned int _histogram[AXISALLY_PROFILE_BUCKETS];
+};
+
+/* Times from construction to the end of the enclosing block */
+class AxisAlly_ProfileScope {
+    public:
+        typedef AxisAlly_ProfileSection::Clock Clock;
+
+        AxisAlly_ProfileScope(AxisAlly_ProfileSection *section) {
+            _section = section;
+            _start = Clock::now();
+        }
+
+        ~AxisAlly_ProfileScope() {
+            _section->record((Clock::ticks)(Clock::now() - _start));
+        }
+
+    private:
+        AxisAlly_ProfileSection *_section;
+        Clock::ticks _start;
+};
+
+#define AXISALLY_PROFILE_SETUP()        AxisAlly_ProfileSection::Clock::setup()
+#define AXISALLY_PROFILE_SCOPE(name) \
+    static AxisAlly_ProfileSection axisally_section_##name(#name); \
+    AxisAlly_ProfileScope axisally_scope_##name(&axisally_section_##name)
+#define AXISALLY_PROFILE_ENTER(name) \
+    static AxisAlly_ProfileSection axisally_section_##name(#name); \
+    AxisAlly_ProfileSection::Clock::ticks axisally_start_##name = \
+        AxisAlly_ProfileSection::Clock::now()
+#define AXISALLY_PROFILE_EXIT(name) \
+    axisally_section_##name.record((AxisAlly_ProfileSection::Clock::ticks) \
+        (AxisAlly_ProfileSection::Clock::now() - axisally_start_##name))
+#define AXISALLY_PROFILE_DUMP(out)      AxisAlly_ProfileSection::dump(out)
+#define AXISALLY_PROFILE_RESET()        AxisAlly_ProfileSection::resetAll()
+
+#else
+
+#define AXISALLY_PROFILE_SETUP()        do { } while (0)
+#define AXISALLY_PROFILE_SCOPE(name)    do { } while (0)
+#define AXISALLY_PROFILE_ENTER(name)    do { } while (0)
+#define AXISALLY_PROFILE_EXIT(name)     do { } while (0)
+#define AXISALLY_PROFILE_DUMP(out)      do { (void)(out); } while (0)
+#define AXISALLY_PROFILE_RESET()        do { } while (0)
+
+#endif /* AXISALLY_PROFILE */
+
+#endif /* AXISALLY_PROFILE_H */
+/* vim: set shiftwidth=4 expandtab:  */
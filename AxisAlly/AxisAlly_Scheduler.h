@@ -0,0 +1,221 @@
+/*
+ * Cooperative task scheduler for the sketch's loop()
+ *
+ * A sketch's loop() tends to do everything in turn: read the serial
+ * port, step the control loop, redraw the LCD, print telemetry. One
+ * slow piece delays all the others, and nothing says by how much.
+ * Here each piece is a task: a function with a period (how often it
+ * is released) and a deadline (how soon after its release it must
+ * have finished). loop() just calls run(), which runs the one task
+ * due with the nearest deadline, start to finish. Nothing is
+ * preempted, so a task that blocks still holds up the rest; what this
+ * adds is that it shows up, as the task's worst execution time and as
+ * overruns of the others, in report().
+ *
+ * Tasks with a period of 0 are background tasks: they take turns
+ * whenever no periodic task is due.
+ *
+ * Clock is anything with a static now() in microseconds: AxisAlly_Micros
+ * on the Arduino, or a mock on the host, which makes the schedule
+ * deterministic for testing.
+ */
+
+#ifndef AXISALLY_SCHEDULER_H
+#define AXISALLY_SCHEDULER_H
+
+#define AXISALLY_TASKS          8       /* Most tasks per scheduler */
+
+#ifdef ARDUINO
+/* The Arduino's microsecond clock */
+struct AxisAlly_Micros {
+    static unsigned long now() {
+        return micros();
+    }
+};
+#endif
+
+/* What the scheduler measured of a task, since the last resetStats() */
+struct AxisAlly_TaskStats {
+    unsigned long runs;
+    unsigned long worst_us;             /* Longest run */
+    unsigned long late_us;              /* Longest from release to start */
+    unsigned long overruns;             /* Finished after the deadline */
+    unsigned long skipped;              /* Releases dropped, being behind */
+};
+
+template <class Clock>
+class AxisAlly_Scheduler {
+    public:
+        AxisAlly_Scheduler() {
+            _tasks = 0;
+            _background = 0;
+        }
+
+        /* Add a task, released every period_us from now
+         *   It must finish within deadline_us of each release; 0 means
+         *   by the next one. A period_us of 0 makes it a background
+         *   task. Returns the task number, or -1 if there's no room.
+         */
+        int add(const char *name, void (*run)(), unsigned long period_us,
+                unsigned long deadline_us = 0) {
+            Task *t;
+
+            if (_tasks >= AXISALLY_TASKS)
+                return -1;
+            t = &_task[_tasks];
+            t->name = name;
+            t->run = run;
+            t->period = period_us;
+            t->deadline = deadline_us ? deadline_us : period_us;
+            t->release = Clock::now();
+            t->enabled = true;
+            clear(&t->stats);
+
+            return _tasks++;
+        }
+
+        /* Stop releasing a task, or start again from now */
+        void enable(int task, bool enabled) {
+            if (enabled && !_task[task].enabled)
+                _task[task].release = Clock::now();
+            _task[task].enabled = enabled;
+        }
+
+        /* Run the due task with the nearest deadline, else a background
+         * task
+         *   Returns false if there was nothing to run.
+         */
+        bool run() {
+            unsigned long now = Clock::now();
+            Task *next = 0;
+            long next_left = 0;
+
+            for (int i = 0; i < _tasks; i++) {
+                Task *t = &_task[i];
+                long left;
+
+                if (!t->enabled || !t->period || (long)(now - t->release) < 0)
+                    continue;
+                /* Time left to the deadline; earlier tasks win ties */
+                left = (long)(t->release + t->deadline - now);
+                if (!next || left < next_left) {
+                    next = t;
+                    next_left = left;
+                }
+            }
+
+            if (next) {
+                dispatch(next, now);
+                return true;
+            }
+
+            for (int i = 0; i < _tasks; i++) {
+                Task *t = &_task[_background];
+
+                _background = (_background + 1) % _tasks;
+                if (t->enabled && !t->period) {
+                    t->release = now;
+                    dispatch(t, now);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        int tasks() {
+            return _tasks;
+        }
+
+        const char *name(int task) {
+            return _task[task].name;
+        }
+
+        const AxisAlly_TaskStats &stats(int task) {
+            return _task[task].stats;
+        }
+
+        void resetStats() {
+            for (int i = 0; i < _tasks; i++)
+                clear(&_task[i].stats);
+        }
+
+        /* One line per task, to Serial or anything with its print()s:
+         *   name runs worst_us late_us overruns skipped
+         */
+        template <class Out>
+        void report(Out &out) {
+            for (int i = 0; i < _tasks; i++) {
+                const AxisAlly_TaskStats &s = _task[i].stats;
+
+                out.print(_task[i].name);
+                out.print(" ");
+                out.print(s.runs);
+                out.print(" ");
+                out.print(s.worst_us);
+                out.print(" ");
+                out.print(s.late_us);
+                out.print(" ");
+                out.print(s.overruns);
+                out.print(" ");
+                out.print(s.skipped);
+                out.print("\r\n");
+            }
+        }
+
+    private:
+        struct Task {
+            const char *name;
+            void (*run)();
+            unsigned long period;       /* 0 for background */
+            unsigned long deadline;     /* After release */
+            unsigned long release;      /* Current release */
+            bool enabled;
+            AxisAlly_TaskStats stats;
+        };
+
+        static void clear(AxisAlly_TaskStats *s) {
+            s->runs = 0;
+            s->worst_us = 0;
+            s->late_us = 0;
+            s->overruns = 0;
+            s->skipped = 0;
+        }
+
+        void dispatch(Task *t, unsigned long start) {
+            AxisAlly_TaskStats *s = &t->stats;
+            unsigned long end, took;
+
+            t->run();
+            end = Clock::now();
+            took = end - start;
+
+            s->runs++;
+            if (took > s->worst_us)
+                s->worst_us = took;
+            if (start - t->release > s->late_us)
+                s->late_us = start - t->release;
+            if (!t->period)
+                return;
+            if (end - t->release > t->deadline)
+                s->overruns++;
+
+            /* Next release; if that has been and gone too, drop the
+             * ones missed rather than run it back to back to catch up
+             */
+            t->release += t->period;
+            if ((long)(end - t->release) >= (long)t->period) {
+                unsigned long missed = (end - t->release) / t->period;
+
+                t->release += missed * t->period;
+                s->skipped += missed;
+            }
+        }
+
+        int _tasks;
+        int _background;                /* Next background task to try */
+        Task _task[AXISALLY_TASKS];
+};
+
+#endif /* AXISALLY_SCHEDULER_H */
+/* vim: set shiftwidth=4 expandtab:  */
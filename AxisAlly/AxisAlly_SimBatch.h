@@ -0,0 +1,230 @@
+/*
+ * Batched AxisAlly_Sim
+ *
+ * Simulates N axes at once, all stepped with the same delta time.
+ * The per-axis state lives in one contiguous array per field instead
+ * of one object per axis, and update() is a single loop over those
+ * arrays whose body is written with selects instead of branches, so
+ * the compiler can vectorize it (-O3).
+ *
+ * The arithmetic is AxisAlly_Sim::update(), operation for operation,
+ * so a batch and a set of AxisAlly_Sim objects given the same commands
+ * produce the same floats.
+ */
+
+#ifndef AXISALLY_SIMBATCH_H
+#define AXISALLY_SIMBATCH_H
+
+#include <string.h>
+
+#include <AxisAlly.h>
+
+class AxisAlly_SimBatch {
+    public:
+        AxisAlly_SimBatch(int axes) {
+            _axes = axes;
+
+            _location = new float[axes];
+            _velocity = new float[axes];
+            _moveto = new int[axes];
+            _location_min = new int[axes];
+            _location_max = new int[axes];
+            _velocity_max = new float[axes];
+            _acceleration_max = new float[axes];
+            _brake_margin = new float[axes];
+            _moving = new int[axes];
+
+            for (int i = 0; i < axes; i++) {
+                _location[i] = 0.0;
+                _velocity[i] = 0.0;
+                _moveto[i] = 0;
+                _location_min[i] = AXISALLY_MIN;
+                _location_max[i] = AXISALLY_MAX;
+                _velocity_max[i] = 100.0;
+                _acceleration_max[i] = 10.0;
+                _brake_margin[i] = 1.2;
+            }
+            memset(_moving, 0, axes * sizeof(*_moving));
+        }
+
+        ~AxisAlly_SimBatch() {
+            delete[] _location;
+            delete[] _velocity;
+            delete[] _moveto;
+            delete[] _location_min;
+            delete[] _location_max;
+            delete[] _velocity_max;
+            delete[] _acceleration_max;
+            delete[] _brake_margin;
+            delete[] _moving;
+        }
+
+        int axes() {
+            return _axes;
+        }
+
+        /* Process location updates for every axis
+         *   Returns the number of axes with movements pending
+         */
+        int update(long delta_ms) {
+            return updateMicros(delta_ms * 1000);
+        }
+
+        int updateMicros(long delta_us) {
+            float sec, loop_sec;
+
+            if (delta_us <= 0) {
+                memset(_moving, 0, _axes * sizeof(*_moving));
+                return 0;
+            }
+            sec = _loop.update(delta_us);
+            loop_sec = _loop.average();
+
+            return step(_axes, sec, loop_sec,
+                        _location, _velocity, _moving,
+                        _moveto, _location_min, _location_max,
+                        _velocity_max, _acceleration_max, _brake_margin);
+        }
+
+        /* Per-axis equivalents of the AxisAlly interface */
+
+        void setLocation(int axis, int location) {
+            _location[axis] = location;
+        }
+
+        /* Stop dead at a location */
+        void stopAt(int axis, int location) {
+            _location[axis] = location;
+            _velocity[axis] = 0.0;
+            _moveto[axis] = location;
+        }
+
+        int getLocation(int axis) {
+            return (int)_location[axis];
+        }
+
+        float getVelocity(int axis) {
+            return _velocity[axis];
+        }
+
+        bool isMoving(int axis) {
+            return _moving[axis];
+        }
+
+        void moveLocation(int axis, int location) {
+            if (location > _location_max[axis])
+                location = _location_max[axis];
+            else if (location < _location_min[axis])
+                location = _location_min[axis];
+            _moveto[axis] = location;
+        }
+
+        void setLocationRange(int axis, int min_location, int max_location) {
+            _location_min[axis] = min_location;
+            _location_max[axis] = max_location;
+        }
+
+        void setAccelerationMax(int axis, float acceleration_max) {
+            _acceleration_max[axis] = acceleration_max;
+        }
+
+        void setVelocityMax(int axis, float velocity_max) {
+            _velocity_max[axis] = velocity_max;
+        }
+
+        void setBrakeMargin(int axis, float brake_margin) {
+            _brake_margin[axis] = brake_margin;
+        }
+
+    private:
+        /* One step of every axis
+         *   The arrays are passed as restrict parameters so the
+         *   compiler knows they don't overlap, which is what lets it
+         *   vectorize the loop without runtime alias checks.
+         */
+        static int step(int axes, float sec, float loop_sec,
+                        float * __restrict location_p,
+                        float * __restrict velocity_p,
+                        int * __restrict moving_p,
+                        const int * __restrict moveto_p,
+                        const int * __restrict location_min_p,
+                        const int * __restrict location_max_p,
+                        const float * __restrict velocity_max_p,
+                        const float * __restrict acceleration_max_p,
+                        const float * __restrict brake_margin_p) {
+            int moving = 0;
+
+            for (int i = 0; i < axes; i++) {
+                float location_delta = velocity_p[i] * sec;
+                float location = location_p[i] + location_delta;
+                float velocity = location_delta / sec;
+                float moveto_delta = moveto_p[i] - location;
+                float location_min = location_min_p[i];
+                float location_max = location_max_p[i];
+                float amax = acceleration_max_p[i];
+                float vmax = velocity_max_p[i];
+
+                bool over = location > location_max;
+                bool under = location < location_min;
+                location = over ? location_max : location;
+                location = under ? location_min : location;
+
+                float moveto_dir = moveto_delta < 0 ? -1.0f : 1.0f;
+                float velocity_dir = velocity < 0 ? -1.0f : 1.0f;
+                bool go = moveto_dir * moveto_delta >
+                          velocity_dir * velocity * loop_sec;
+
+                /* Both candidate velocities, then pick one */
+                float b_distance = velocity * velocity / amax;
+                /* Room to stop before the end of the range we're
+                 * heading for, worked out for both ends and masked, so
+                 * nothing needs computing inside a select (where the
+                 * compiler would branch round it instead of vectorizing)
+                 */
+                bool bound_max = (velocity >= 0) &
+                                 (b_distance / 2 > (location_max - location) - velocity * loop_sec);
+                bool bound_min = (velocity < 0) &
+                                 (b_distance / 2 > (location - location_min) + velocity * loop_sec);
+                bool slow = (b_distance * brake_margin_p[i] > fabsf(moveto_delta)) |
+                            bound_max | bound_min;
+                bool fast = moveto_dir * velocity < vmax;
+
+                float v_slow = velocity + -velocity_dir * amax * sec;
+                v_slow = (velocity_dir * v_slow < 0) ? 0.0f : v_slow;
+
+                float v_fast = velocity + moveto_dir * amax * sec;
+                float v_cap = moveto_dir * vmax;
+                v_fast = (moveto_dir * v_fast > vmax) ? v_cap : v_fast;
+
+                float v_next = slow ? v_slow : (fast ? v_fast : velocity);
+                velocity = go ? v_next : velocity;
+
+                bool still = go & !over & !under;
+
+                location_p[i] = location;
+                velocity_p[i] = velocity;
+                moving_p[i] = still;
+                moving += still;
+            }
+
+            return moving;
+        }
+
+        int _axes;
+
+        float *_location;
+        float *_velocity;
+        int   *_moveto;
+        int   *_location_min;
+        int   *_location_max;
+        float *_velocity_max;
+        float *_acceleration_max;
+        float *_brake_margin;
+        int   *_moving;        /* Same width as the floats, so the
+                                 * update loop vectorizes */
+
+        AxisAlly_LoopStats _loop;
+};
+
+#endif /* AXISALLY_SIMBATCH_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,388 @@
+/*
+ * AxisAlly for a stepper motor
+ *
+ * Motor is Adafruit_StepperMotor (Motor Shield v2) or AF_Stepper (v1);
+ * both take onestep(FORWARD/BACKWARD, SINGLE/DOUBLE/INTERLEAVE/MICROSTEP).
+ * Include this after the motor library, which defines those constants.
+ *
+ * Open loop: the move is planned by an AxisAlly_SimStatic under this
+ * axis' limits, in steps, and each update() issues single steps until
+ * the motor has caught up with the planned location. Nothing blocks for
+ * longer than the steps one update needs, so other axes and the serial
+ * port keep being serviced while the stepper moves.
+ *
+ * AxisAlly_StepperTimed does the same from a hardware timer instead:
+ * the step times come from a constant-acceleration ramp evaluated once
+ * per step in the timer interrupt, so the step rate no longer depends
+ * on how often loop() comes around.
+ *
+ * Locations are in the steps of the chosen style: full steps for
+ * SINGLE and DOUBLE, half steps for INTERLEAVE, and microsteps (16 to
+ * a full step with the Adafruit library) for MICROSTEP.
+ */
+
+#ifndef AXISALLY_STEPPER_H
+#define AXISALLY_STEPPER_H
+
+#include <AxisAlly.h>
+
+template <class Motor>
+class AxisAlly_StepperStatic :
+        public AxisAlly_Static<AxisAlly_StepperStatic<Motor> > {
+    public:
+        AxisAlly_StepperStatic(Motor *motor, int style = DOUBLE) {
+            _motor = motor;
+            _style = style;
+            _position = 0;
+            _steps_max = 16;
+        }
+
+        void begin() {
+        }
+
+        /* Process location updates
+         *   Returns false if no movements are pending
+         */
+        bool update(long delta_ms) {
+            return updateMicros(delta_ms * 1000);
+        }
+
+        bool updateMicros(long delta_us) {
+            bool moving;
+            int target, steps;
+
+            if (delta_us <= 0)
+                return false;
+
+            moving = this->plan(_profile, delta_us);
+
+            target = _profile.getLocation();
+            for (steps = 0; _position != target && steps < _steps_max; steps++) {
+                if (_position < target) {
+                    _motor->onestep(FORWARD, _style);
+                    _position++;
+                } else {
+                    _motor->onestep(BACKWARD, _style);
+                    _position--;
+                }
+            }
+
+            return moving || _position != target;
+        }
+
+        /* Set the current location (for homing) */
+        void setLocation(int location) {
+            _position = location;
+            _profile.stopAt(location);
+            this->_moveto = location;
+        }
+
+        int getLocation() {
+            return _position;
+        }
+
+        /* Get the planned velocity, in steps/sec */
+        float getVelocity() {
+            return _profile.getVelocity();
+        }
+
+        /* Set the most steps a single update() may issue
+         *   Each one is an I2C transaction on the v2 shield, so this
+         *   bounds how long update() can take.
+         */
+        void setStepsMax(int steps_max) {
+            _steps_max = steps_max;
+        }
+
+    protected:
+        Motor *_motor;
+        int _style;             /* SINGLE, DOUBLE, INTERLEAVE, MICROSTEP */
+        int _position;          /* Steps issued so far */
+        int _steps_max;         /* Most steps per update() */
+
+        AxisAlly_SimStatic _profile;
+};
+
+/* The same, behind an AxisAlly pointer */
+template <class Motor>
+class AxisAlly_Stepper :
+        public AxisAlly_Virtual<AxisAlly_StepperStatic<Motor> > {
+    public:
+        AxisAlly_Stepper(Motor *motor, int style = DOUBLE) :
+            AxisAlly_Virtual<AxisAlly_StepperStatic<Motor> >(motor, style) { }
+};
+
+/* Step timing for a constant-acceleration ramp
+ *   From D. Austin, "Generate stepper-motor speed profiles in real
+ *   time": each step interval follows from the last with a single
+ *   division, c[n] = c[n-1] - 2 c[n-1] / (4n + 1), where n counts the
+ *   steps since the ramp began. Decelerating runs the same recurrence
+ *   backwards, so from interval c[n] it takes n + 1 more steps to come
+ *   to rest. The first interval is 0.676 * f * sqrt(2 / a), which
+ *   makes up for the recurrence being inexact for small n.
+ *
+ *   Intervals are in timer ticks, kept with 8 fractional bits so the
+ *   ramp doesn't stall on rounding at high step rates.
+ */
+class AxisAlly_StepRamp {
+    public:
+        AxisAlly_StepRamp() {
+            _position = 0;
+            _target = 0;
+            _dir = 1;
+            _n = 0;
+            _c = 0;
+            _c0 = 0xffffUL << 8;
+            _c_min = 0xffffUL << 8;
+            _tick_hz = 1000000;
+        }
+
+        /* Set the timer rate, and the limits in steps/sec and
+         * steps/sec per sec
+         *   An acceleration below accelerationMin(tick_hz) is raised
+         *   to it.
+         */
+        void setLimits(unsigned long tick_hz, float velocity_max,
+                       float acceleration_max) {
+            _tick_hz = tick_hz;
+            if (acceleration_max < accelerationMin(tick_hz))
+                acceleration_max = accelerationMin(tick_hz);
+            _c0 = interval(0.676 * tick_hz * sqrt(2.0 / acceleration_max));
+            _c_min = interval((float)tick_hz / velocity_max);
+            if (_c_min > _c0)
+                _c_min = _c0;
+        }
+
+        /* The least acceleration there is a first interval for: a
+         * gentler start needs more than the timer's 16 bits. About
+         * 850 steps/sec per sec at 2MHz (clk/8 at 16MHz), 13 at 250kHz
+         * (clk/64).
+         */
+        static float accelerationMin(unsigned long tick_hz) {
+            float c0 = 0.676 * tick_hz / 0xffff;
+
+            return 2.0 * c0 * c0;
+        }
+
+        void setTarget(long target) {
+            _target = target;
+        }
+
+        /* Set the current position, and stop there */
+        void setPosition(long position) {
+            _position = position;
+            _target = position;
+            _n = 0;
+            _c = 0;
+        }
+
+        long getPosition() {
+            return _position;
+        }
+
+        /* Steps/sec, signed */
+        float getVelocity() {
+            if (_c == 0)
+                return 0.0;
+            return _dir * (float)_tick_hz * 256 / _c;
+        }
+
+        bool isMoving() {
+            return _c != 0 || _position != _target;
+        }
+
+        /* Take the step that is due, and schedule the next one
+         *   Call this when the interval it last returned has elapsed.
+         *   Returns the ticks until the next call, or 0 if the ramp is
+         *   at rest until the target changes.
+         */
+        unsigned int tick() {
+            long remaining;
+
+            if (_c == 0) {
+                /* At rest: first step in c0 */
+                if (_position == _target)
+                    return 0;
+                _dir = _position < _target ? 1 : -1;
+                _n = 0;
+                _c = _c0;
+                return _c >> 8;
+            }
+
+            _position += _dir;
+
+            /* Steps left to go in the current direction */
+            remaining = _dir * (_target - _position);
+
+            if (remaining <= 0 && _n == 0) {
+                /* Stopped, on the target or short of turning round */
+                _c = 0;
+                return 0;
+            } else if (remaining >= _n + 2 && _c > _c_min) {
+                /* Room to speed up and still stop in time */
+                _n++;
+                _c -= 2 * _c / (4 * _n + 1);
+                if (_c < _c_min)
+                    _c = _c_min;
+            } else if (remaining <= _n) {
+                /* Slow down: to stop on the target, or to turn round */
+                _c += 2 * _c / (4 * _n - 1);
+                _n--;
+            }
+
+            return _c >> 8;
+        }
+
+    private:
+        static unsigned long interval(float ticks) {
+            if (ticks > 0xffff)
+                ticks = 0xffff;
+            else if (ticks < 1)
+                ticks = 1;
+            return (unsigned long)(ticks * 256);
+        }
+
+        long _position;         /* Steps taken */
+        long _target;           /* Where to stop */
+        int _dir;               /* Direction of the current ramp, +/-1 */
+        long _n;                /* Steps into the current ramp */
+        unsigned long _c;       /* Current interval, ticks << 8, or
+                                 * 0 at rest */
+        unsigned long _c0;      /* First interval from rest */
+        unsigned long _c_min;   /* Interval at the velocity limit */
+        unsigned long _tick_hz; /* Timer rate */
+};
+
+/* Stepper driven from a timer interrupt
+ *   The sketch sets up a timer and, from its interrupt, calls tick()
+ *   and schedules the next interrupt that many ticks later (or polls
+ *   again shortly if it returned 0). tick() only decides when steps
+ *   happen; the motor itself is driven from updateMicros() in loop(),
+ *   because on the v2 shield each step is an I2C transfer, and the
+ *   Wire library can't be used from an interrupt.
+ *
+ *   getLocation() is the step the motor has actually reached, so it
+ *   can be read mid-move. The step rate must stay within what loop()
+ *   can issue, or the motor falls behind the ramp.
+ */
+template <class Motor>
+class AxisAlly_StepperTimedStatic :
+        public AxisAlly_Static<AxisAlly_StepperTimedStatic<Motor> > {
+    public:
+        AxisAlly_StepperTimedStatic(Motor *motor, unsigned long tick_hz,
+                                    int style = DOUBLE) {
+            _motor = motor;
+            _tick_hz = tick_hz;
+            _style = style;
+            _position = 0;
+            _steps_max = 16;
+            _velocity_ramp = 0.0;
+            _acceleration_ramp = 0.0;
+        }
+
+        void begin() {
+            limits();
+        }
+
+        /* From the timer interrupt */
+        unsigned int tick() {
+            return _ramp.tick();
+        }
+
+        /* Process location updates
+         *   Returns false if no movements are pending
+         */
+        bool update(long delta_ms) {
+            return updateMicros(delta_ms * 1000);
+        }
+
+        bool updateMicros(long delta_us) {
+            long ordered;
+            bool moving;
+            int steps;
+
+            noInterrupts();
+            limits();
+            _ramp.setTarget(this->_moveto);
+            ordered = _ramp.getPosition();
+            moving = _ramp.isMoving();
+            interrupts();
+
+            for (steps = 0; _position != ordered && steps < _steps_max; steps++) {
+                if (_position < ordered) {
+                    _motor->onestep(FORWARD, _style);
+                    _position++;
+                } else {
+                    _motor->onestep(BACKWARD, _style);
+                    _position--;
+                }
+            }
+
+            return moving || _position != ordered;
+        }
+
+        /* Set the current location (for homing) */
+        void setLocation(int location) {
+            noInterrupts();
+            _ramp.setPosition(location);
+            interrupts();
+            _position = location;
+            this->_moveto = location;
+        }
+
+        int getLocation() {
+            return _position;
+        }
+
+        /* Get the ramp's velocity, in steps/sec */
+        float getVelocity() {
+            float velocity;
+
+            noInterrupts();
+            velocity = _ramp.getVelocity();
+            interrupts();
+
+            return velocity;
+        }
+
+        /* Set the most steps a single update() may issue */
+        void setStepsMax(int steps_max) {
+            _steps_max = steps_max;
+        }
+
+    protected:
+        /* Pass limit changes on to the ramp (interrupts off) */
+        void limits() {
+            if (this->_velocity_max == _velocity_ramp &&
+                this->_acceleration_max == _acceleration_ramp)
+                return;
+
+            _velocity_ramp = this->_velocity_max;
+            _acceleration_ramp = this->_acceleration_max;
+            _ramp.setLimits(_tick_hz, _velocity_ramp, _acceleration_ramp);
+        }
+
+        Motor *_motor;
+        unsigned long _tick_hz; /* Timer rate */
+        int _style;             /* SINGLE, DOUBLE, INTERLEAVE, MICROSTEP */
+        long _position;         /* Steps issued to the motor */
+        int _steps_max;         /* Most steps per update() */
+
+        float _velocity_ramp;   /* Limits the ramp was last given */
+        float _acceleration_ramp;
+
+        AxisAlly_StepRamp _ramp;
+};
+
+/* The same, behind an AxisAlly pointer */
+template <class Motor>
+class AxisAlly_StepperTimed :
+        public AxisAlly_Virtual<AxisAlly_StepperTimedStatic<Motor> > {
+    public:
+        AxisAlly_StepperTimed(Motor *motor, unsigned long tick_hz,
+                              int style = DOUBLE) :
+            AxisAlly_Virtual<AxisAlly_StepperTimedStatic<Motor> >(motor, tick_hz, style) { }
+};
+
+#endif /* AXISALLY_STEPPER_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,286 @@
+/*
+ * Interrupt-driven I2C master queue
+ *
+ * Wire blocks loop() for the whole of every transfer. Here transfers
+ * are queued instead, and the TWI interrupt moves each one along a
+ * byte at a time, so the bus runs while loop() gets on with control.
+ * Each transfer has a priority, lower first; a transfer already on the
+ * bus finishes, then the most urgent queued one goes next, so motor
+ * commands get in ahead of a queue of LCD updates. Back to back
+ * transfers are joined with a repeated start, and the bus is only let
+ * go once the queue is empty.
+ *
+ * Transfers are either an AxisAlly_TWITransfer the caller owns (for
+ * reads, or to be told when it's done), or Wire-style writes through
+ * beginTransmission()/write()/endTransmission(), buffered in a few
+ * slots of the queue's own. The Wire-style calls make this a drop-in
+ * Bus for AxisAlly_MotorShield2.
+ *
+ * Hw is the TWI hardware: AxisAlly_TWIAVR, or a mock on the host. The
+ * sketch hooks the interrupt up itself:
+ *
+ *   AxisAlly_TWIQueue<AxisAlly_TWIAVR> twi;
+ *   ISR(TWI_vect) { twi.interrupt(); }
+ *
+ * which means the Wire library, which has its own TWI_vect, can't be
+ * linked into the same sketch.
+ */
+
+#ifndef AXISALLY_TWI_H
+#define AXISALLY_TWI_H
+
+/* AxisAlly_TWITransfer status */
+#define AXISALLY_TWI_DONE       0
+#define AXISALLY_TWI_PENDING    1       /* Queued, or on the bus */
+#define AXISALLY_TWI_NACK       2       /* Address or data not acked */
+#define AXISALLY_TWI_ERROR      3       /* Bus error */
+
+#define AXISALLY_TWI_SLOTS      4       /* Wire-style writes in flight */
+#define AXISALLY_TWI_BUFFER     32      /* Bytes per Wire-style write */
+
+/* TWSR status codes, master mode */
+#define AXISALLY_TWI_START      0x08
+#define AXISALLY_TWI_REP_START  0x10
+#define AXISALLY_TWI_SLA_W_ACK  0x18
+#define AXISALLY_TWI_SLA_W_NACK 0x20
+#define AXISALLY_TWI_DATA_ACK   0x28
+#define AXISALLY_TWI_DATA_NACK  0x30
+#define AXISALLY_TWI_SLA_R_ACK  0x40
+#define AXISALLY_TWI_SLA_R_NACK 0x48
+#define AXISALLY_TWI_RECV_ACK   0x50
+#define AXISALLY_TWI_RECV_NACK  0x58
+
+/* One transfer: write, then read (after a repeated start)
+ *   Either length may be 0; both 0 just checks the address is there.
+ *   done, if set, is called from the interrupt when it is finished;
+ *   it mustn't submit() anything. Leave the transfer alone until then.
+ */
+struct AxisAlly_TWITransfer {
+    unsigned char address;
+    unsigned char priority;             /* Lower goes first */
+    const unsigned char *write;
+    unsigned char write_len;
+    unsigned char *read;
+    unsigned char read_len;
+    void (*done)(AxisAlly_TWITransfer *transfer);
+    void *context;                      /* For done() */
+
+    volatile unsigned char status;      /* AXISALLY_TWI_* */
+    AxisAlly_TWITransfer *next;         /* Queue link */
+};
+
+#ifdef TWCR
+/* The ATmega TWI */
+struct AxisAlly_TWIAVR {
+    static void begin(unsigned long hz) {
+        TWSR = 0;
+        TWBR = (F_CPU / hz - 16) / 2;
+        TWCR = _BV(TWEN);
+    }
+
+    static unsigned char status() {
+        return TWSR & 0xf8;
+    }
+
+    static void start() {
+        /* After a stop, wait for it to go out first */
+        while (TWCR & _BV(TWSTO))
+            ;
+        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+    }
+
+    static void stop() {
+        TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+    }
+
+    static void send(unsigned char data) {
+        TWDR = data;
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    }
+
+    static void receive(bool ack) {
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | (ack ? _BV(TWEA) : 0);
+    }
+
+    static unsigned char data() {
+        return TWDR;
+    }
+
+    /* Waiting on the interrupt; nothing to do */
+    static void poll() {
+    }
+};
+#endif
+
+template <class Hw>
+class AxisAlly_TWIQueue {
+    public:
+        AxisAlly_TWIQueue() {
+            _head = 0;
+            _active = 0;
+            _index = 0;
+            _priority = 1;
+            _fill = 0;
+            for (int i = 0; i < AXISALLY_TWI_SLOTS; i++) {
+                _slot[i].status = AXISALLY_TWI_DONE;
+                _slot[i].write = _buffer[i];
+                _slot[i].read = 0;
+                _slot[i].read_len = 0;
+                _slot[i].done = 0;
+            }
+        }
+
+        /* Set up the TWI, with the bus clock in Hz */
+        void begin(unsigned long hz = 400000) {
+            Hw::begin(hz);
+        }
+
+        /* Queue a transfer
+         *   Returns false if it is still queued from last time.
+         */
+        bool submit(AxisAlly_TWITransfer *transfer) {
+            AxisAlly_TWITransfer * volatile *link;
+
+            if (transfer->status == AXISALLY_TWI_PENDING)
+                return false;
+            transfer->status = AXISALLY_TWI_PENDING;
+
+            noInterrupts();
+            /* Behind everything as urgent, ahead of everything less */
+            for (link = &_head; *link && (*link)->priority <= transfer->priority;
+                 link = &(*link)->next)
+                ;
+            transfer->next = *link;
+            *link = transfer;
+
+            if (!_active)
+                next();
+            interrupts();
+
+            return true;
+        }
+
+        /* Is anything queued or on the bus? */
+        bool busy() {
+            return _active || _head;
+        }
+
+        /* Call from ISR(TWI_vect) */
+        void interrupt() {
+            AxisAlly_TWITransfer *t = _active;
+
+            switch (Hw::status()) {
+            case AXISALLY_TWI_START:
+            case AXISALLY_TWI_REP_START:
+                if (_index < t->write_len || !t->read_len)
+                    Hw::send(t->address << 1);
+                else
+                    Hw::send(t->address << 1 | 1);
+                break;
+            case AXISALLY_TWI_SLA_W_ACK:
+            case AXISALLY_TWI_DATA_ACK:
+                if (_index < t->write_len)
+                    Hw::send(t->write[_index++]);
+                else if (t->read_len)
+                    Hw::start();
+                else
+                    finish(AXISALLY_TWI_DONE);
+                break;
+            case AXISALLY_TWI_SLA_R_ACK:
+                _index = 0;
+                Hw::receive(t->read_len > 1);
+                break;
+            case AXISALLY_TWI_RECV_ACK:
+                t->read[_index++] = Hw::data();
+                Hw::receive(_index < t->read_len - 1);
+                break;
+            case AXISALLY_TWI_RECV_NACK:
+                t->read[_index++] = Hw::data();
+                finish(AXISALLY_TWI_DONE);
+                break;
+            case AXISALLY_TWI_SLA_W_NACK:
+            case AXISALLY_TWI_DATA_NACK:
+            case AXISALLY_TWI_SLA_R_NACK:
+                finish(AXISALLY_TWI_NACK);
+                break;
+            default:
+                /* Bus error, or lost arbitration */
+                finish(AXISALLY_TWI_ERROR);
+                break;
+            }
+        }
+
+        /* Priority for the Wire-style writes that follow */
+        void setPriority(int priority) {
+            _priority = priority;
+        }
+
+        /* Wire-style writes
+         *   endTransmission() queues the write and returns 0 straight
+         *   away; the data is copied, so the caller's buffer is free.
+         *   These only wait if every slot is still queued.
+         */
+        void beginTransmission(int address) {
+            for (;;) {
+                for (_fill = 0; _fill < AXISALLY_TWI_SLOTS; _fill++) {
+                    if (_slot[_fill].status != AXISALLY_TWI_PENDING)
+                        break;
+                }
+                if (_fill < AXISALLY_TWI_SLOTS)
+                    break;
+                Hw::poll();
+            }
+
+            _slot[_fill].address = address;
+            _slot[_fill].priority = _priority;
+            _slot[_fill].write_len = 0;
+        }
+
+        void write(int data) {
+            AxisAlly_TWITransfer *t = &_slot[_fill];
+
+            if (t->write_len < AXISALLY_TWI_BUFFER)
+                _buffer[_fill][t->write_len++] = data;
+        }
+
+        int endTransmission() {
+            submit(&_slot[_fill]);
+            return 0;
+        }
+
+    private:
+        /* Start the next queued transfer, or let go of the bus */
+        void next() {
+            _active = _head;
+            if (!_active) {
+                Hw::stop();
+                return;
+            }
+
+            _head = _active->next;
+            _index = 0;
+            Hw::start();
+        }
+
+        void finish(unsigned char status) {
+            AxisAlly_TWITransfer *t = _active;
+
+            t->status = status;
+            if (t->done)
+                t->done(t);
+            next();
+        }
+
+        AxisAlly_TWITransfer * volatile _head;  /* Queued, most urgent
+                                                 * first */
+        AxisAlly_TWITransfer * volatile _active;        /* On the bus */
+        unsigned char _index;           /* Into the active transfer */
+
+        unsigned char _priority;        /* For Wire-style writes */
+        unsigned char _fill;            /* Slot being written */
+        AxisAlly_TWITransfer _slot[AXISALLY_TWI_SLOTS];
+        unsigned char _buffer[AXISALLY_TWI_SLOTS][AXISALLY_TWI_BUFFER];
+};
+
+#endif /* AXISALLY_TWI_H */
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,65 @@
+/*
+ * Smallest useful program around one simulated axis, built once with
+ * the virtual AxisAlly_Sim and once (-DAXISALLY_STATIC) with
+ * AxisAlly_SimStatic, to compare code and data size. See "make size"
+ * and "make avr-size".
+ *
+ * On AVR, Timer1 runs at the CPU clock and axisally_cycles holds the
+ * cycle count of the most recent update(); read it from an instruction
+ * set simulator (e.g. simavr with gdb) after the loop has run.
+ */
+
+#include <stdlib.h>
+
+#include <AxisAlly.h>
+
+#ifdef __AVR__
+#include <avr/io.h>
+
+/* No C++ runtime without the Arduino core */
+void operator delete(void *p) { free(p); }
+void operator delete(void *p, size_t) { free(p); }
+extern "C" void __cxa_pure_virtual() { for (;;); }
+
+volatile uint16_t axisally_cycles;
+
+#define CYCLES_START()  do { TCCR1A = 0; TCCR1B = _BV(CS10); TCNT1 = 0; } while (0)
+#define CYCLES_STOP()   do { axisally_cycles = TCNT1; } while (0)
+#else
+#define CYCLES_START()  do { } while (0)
+#define CYCLES_STOP()   do { } while (0)
+#endif
+
+volatile long delta_ms = 10;
+volatile int location;
+
+int main(void)
+{
+#ifdef AXISALLY_STATIC
+    AxisAlly_SimStatic sim;
+    AxisAlly_Static<AxisAlly_SimStatic> &axis = sim;
+#define AXIS    axis.
+#else
+    AxisAlly_Sim sim;
+    AxisAlly * volatile axis = &sim;
+#define AXIS    axis->
+#endif
+
+    AXIS setLocationRange(0, 1000);
+    AXIS begin();
+
+    for (int i = 0; i < 1000; i++) {
+        bool moving;
+
+        CYCLES_START();
+        moving = AXIS update(delta_ms);
+        CYCLES_STOP();
+
+        if (!moving)
+            AXIS moveLocation(rand() % 1000);
+        location = AXIS getLocation();
+    }
+
+    return 0;
+}
+/* vim: set shiftwidth=4 expandtab:  */
@@ -0,0 +1,86 @@
+/*
+ * Per-update cost of AxisAlly_Sim through the virtual AxisAlly
+ * interface against AxisAlly_SimStatic called directly.
+ *
+ * Both run the same script: move to a random location, update until
+ * the move finishes, repeat. Times are in TSC cycles on x86, and in
+ * nanoseconds anywhere else.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static inline unsigned long long bench_now() { return __rdtsc(); }
+#else
+#define BENCH_UNIT "ns"
+static inline unsigned long long bench_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#include <AxisAlly.h>
+
+#define BENCH_UPDATES   10000000L
+
+/* Generic over the static interface, so the calls can inline */
+template <class Axis>
+static unsigned long long bench_static(AxisAlly_Static<Axis> &axis)
+{
+    unsigned long long start = bench_now();
+
+    srand48(1);
+    for (long i = 0; i < BENCH_UPDATES; i++) {
+        if (!axis.update(10))
+            axis.moveLocation(drand48() * 640);
+    }
+
+    return bench_now() - start;
+}
+
+static unsigned long long bench_virtual(AxisAlly *axis)
+{
+    unsigned long long start = bench_now();
+
+    srand48(1);
+    for (long i = 0; i < BENCH_UPDATES; i++) {
+        if (!axis->update(10))
+            axis->moveLocation(drand48() * 640);
+    }
+
+    return bench_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    AxisAlly_SimStatic s;
+    AxisAlly_Sim v;
+
+    /* Launder the pointer so the compiler can't devirtualize it */
+    AxisAlly * volatile vp = &v;
+    unsigned long long ts, tv;
+
+    s.setLocationRange(0, 640);
+    vp->setLocationRange(0, 640);
+
+    tv = bench_virtual(vp);
+    ts = bench_static(s);
+
+    printf("%ld updates (" BENCH_UNIT " per update, including the script)\n",
+           BENCH_UPDATES);
+    printf("  AxisAlly_Sim (virtual)   %6.2f  sizeof %zu\n",
+           (double)tv / BENCH_UPDATES, sizeof(v));
+    printf("  AxisAlly_SimStatic       %6.2f  sizeof %zu\n",
+           (double)ts / BENCH_UPDATES, sizeof(s));
+    printf("  final locations          %d / %d\n",
+           vp->getLocation(), s.getLocation());
+
+    return 0;
+}
+/* vim: set shiftwidth=4 expandtab:  */
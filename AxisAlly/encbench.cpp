@@ -0,0 +1,306 @@
+/*
+ * How fast the PJRC Encoder library's quadrature decoder can go
+ *
+ * The encoder's two pins are mocked as two bits of RAM (host/Arduino.h),
+ * and Encoder::update() is run once per sample of a synthetic waveform,
+ * through read() as built with ENCODER_DO_NOT_USE_INTERRUPTS. That is
+ * the same update() the pin change interrupts run, less the interrupt
+ * entry and exit.
+ *
+ * On the host this is the library's C path. It reports samples and
+ * edges per second for a set of waveforms - clean, idle, contact
+ * bounce, single-sample glitches, and skipped states (both pins
+ * changing at once, as when an edge is missed) - the count error each
+ * one ends up with, and the excess: how much further the count moved
+ * back and forth than the waveform did, which is what a PID chases.
+ * Only skipped states should leave an error: the decoder guesses
+ * those as two counts forward.
+ *
+ * The same waveforms then go through AxisAlly_QuadDecoder, without a
+ * filter and with a 2us dwell, taking the samples as 1us apart. The
+ * filter drops the glitches, and the excess with them, but also every
+ * edge that comes sooner than 2us after the last; only the noise
+ * waveform is slow enough for it.
+ *
+ * On the ATmega (make avr-encbench) it's the assembly path, and the
+ * cost of one update for each of the 16 old/new pin states is timed in
+ * CPU cycles with Timer1, into encbench_cycles[]; likewise for
+ * AxisAlly_QuadDecoder with a filter, in encbench_filter_cycles[], for
+ * the sample() that sees the new pins plus the one that counts them.
+ * Run it in simavr and read them with avr-gdb at encbench_done():
+ *
+ *   simavr -m atmega2560 -f 16000000 -g encbench.elf &
+ *   avr-gdb encbench.elf -ex 'target remote :1234' \
+ *       -ex 'break encbench_done' -ex continue -ex 'print encbench_cycles'
+ *
+ * Either way, the fastest the carriage can move is the sustainable edge
+ * rate divided by the encoder's counts per mm.
+ */
+
+#include <Encoder.h>
+#include <AxisAlly_Encoder.h>
+
+volatile uint8_t encbench_port;
+
+#ifdef __AVR__
+
+/* Cycles for one update, by new pins << 2 | old pins, less the timer
+ * read overhead in encbench_overhead
+ */
+volatile uint16_t encbench_cycles[16];
+volatile uint16_t encbench_filter_cycles[16];
+volatile uint16_t encbench_overhead;
+volatile long encbench_count;
+
+/* Somewhere to put a breakpoint */
+void __attribute__((noinline)) encbench_done()
+{
+    asm volatile ("");
+}
+
+int main(void)
+{
+    Encoder enc(0, 1);
+    AxisAlly_QuadDecoder dec;
+    uint16_t start;
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+
+    start = TCNT1;
+    asm volatile ("");
+    encbench_overhead = TCNT1 - start;
+
+    for (uint8_t s = 0; s < 16; s++) {
+        encbench_port = s & 3;
+        enc.read();
+        encbench_port = s >> 2;
+
+        start = TCNT1;
+        enc.read();
+        encbench_cycles[s] = TCNT1 - start - encbench_overhead;
+    }
+
+    dec.setFilter(20);
+    for (uint8_t s = 0; s < 16; s++) {
+        dec.begin(s & 3);
+
+        start = TCNT1;
+        dec.sample(s >> 2, 0);
+        dec.sample(s >> 2, 20);
+        encbench_filter_cycles[s] = TCNT1 - start - encbench_overhead;
+    }
+    encbench_count = dec.count();
+
+    encbench_done();
+    for (;;)
+        ;
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#define ENCBENCH_SAMPLES        (1L << 22)
+
+/* Pins (bit 1 pin 2, bit 0 pin 1) for count & 3, counting up */
+static const unsigned char gray[4] = { 0, 2, 3, 1 };
+
+struct Wave {
+    const char *name;
+    std::vector<unsigned char> samples;
+    long position;                      /* Where it really ends up */
+    long moved;                         /* Counts moved, either way */
+    long edges;                         /* Samples unlike the last */
+};
+
+static void emit(Wave *w, unsigned char pins)
+{
+    unsigned char last = w->samples.empty() ? gray[0] : w->samples.back();
+
+    if (pins != last)
+        w->edges++;
+    w->samples.push_back(pins);
+}
+
+/* A count every sample, now and then changing direction; skip makes
+ * every skip'th count a jump of two
+ */
+static void wave_clean(Wave *w, int skip)
+{
+    int dir = 1;
+
+    for (long i = 0; i < ENCBENCH_SAMPLES; i++) {
+        if (lrand48() % 64 == 0)
+            dir = -dir;
+        w->position += dir;
+        w->moved++;
+        if (skip && i % skip == 0) {
+            w->position += dir;
+            w->moved++;
+        }
+        emit(w, gray[w->position & 3]);
+    }
+}
+
+static void wave_idle(Wave *w)
+{
+    for (long i = 0; i < ENCBENCH_SAMPLES; i++)
+        emit(w, gray[0]);
+}
+
+/* Each edge chatters: new, old, new */
+static void wave_bounce(Wave *w)
+{
+    int dir = 1;
+
+    while ((long)w->samples.size() < ENCBENCH_SAMPLES) {
+        unsigned char old = gray[w->position & 3];
+
+        if (lrand48() % 64 == 0)
+            dir = -dir;
+        w->position += dir;
+        w->moved++;
+        emit(w, gray[w->position & 3]);
+        emit(w, old);
+        emit(w, gray[w->position & 3]);
+    }
+}
+
+/* A count every 8 samples, and every other count a pin flips for a
+ * single sample somewhere in between
+ */
+static void wave_noise(Wave *w)
+{
+    int dir = 1;
+
+    while ((long)w->samples.size() < ENCBENCH_SAMPLES) {
+        int glitch = lrand48() % 2 ? 1 + lrand48() % 6 : -1;
+        unsigned char pins;
+
+        if (lrand48() % 64 == 0)
+            dir = -dir;
+        w->position += dir;
+        w->moved++;
+
+        pins = gray[w->position & 3];
+        for (int k = 0; k < 8; k++)
+            emit(w, k == glitch ? pins ^ (1 << (lrand48() % 2)) : pins);
+    }
+}
+
+static void report(Wave *w, double sec, long decoded, long moved)
+{
+    long n = w->samples.size();
+
+    printf("  %-8s %5.2f ns/sample  %8.1f Medges/s  error %6ld  excess %6ld\n",
+           w->name, sec * 1e9 / n, w->edges / sec / 1e6,
+           decoded - w->position, moved - w->moved);
+}
+
+/* Encoder.h */
+static void run_encoder(Wave *w)
+{
+    std::chrono::steady_clock::time_point start, end;
+    const unsigned char *s = &w->samples[0];
+    long n = w->samples.size();
+    long last, moved = 0;
+
+    encbench_port = gray[0];
+    Encoder enc(0, 1);
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        encbench_port = s[i];
+        enc.read();
+    }
+    end = std::chrono::steady_clock::now();
+
+    /* Again, untimed, for the excess */
+    encbench_port = gray[0];
+    Encoder check(0, 1);
+    last = 0;
+    for (long i = 0; i < n; i++) {
+        encbench_port = s[i];
+        moved += labs(check.read() - last);
+        last = check.read();
+    }
+
+    report(w, std::chrono::duration<double>(end - start).count(),
+           enc.read(), moved);
+}
+
+/* AxisAlly_QuadDecoder, a sample a microsecond */
+static void run_decoder(Wave *w, unsigned int dwell_us)
+{
+    std::chrono::steady_clock::time_point start, end;
+    const unsigned char *s = &w->samples[0];
+    long n = w->samples.size();
+    long last, moved = 0;
+    AxisAlly_QuadDecoder dec, check;
+
+    dec.setFilter(dwell_us);
+    dec.begin(gray[0]);
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++)
+        dec.sample(s[i], i);
+    end = std::chrono::steady_clock::now();
+
+    check.setFilter(dwell_us);
+    check.begin(gray[0]);
+    last = 0;
+    for (long i = 0; i < n; i++) {
+        check.sample(s[i], i);
+        moved += labs(check.count() - last);
+        last = check.count();
+    }
+
+    /* Let the last edge count */
+    dec.sample(s[n - 1], n + dwell_us);
+    report(w, std::chrono::duration<double>(end - start).count(),
+           dec.count(), moved);
+}
+
+int main(int argc, char **argv)
+{
+    Wave waves[5];
+
+    srand48(1);
+    waves[0].name = "clean";
+    waves[1].name = "idle";
+    waves[2].name = "bounce";
+    waves[3].name = "noise";
+    waves[4].name = "skipped";
+    for (int i = 0; i < 5; i++) {
+        waves[i].position = 0;
+        waves[i].moved = 0;
+        waves[i].edges = 0;
+        waves[i].samples.reserve(ENCBENCH_SAMPLES + 8);
+    }
+    wave_clean(&waves[0], 0);
+    wave_idle(&waves[1]);
+    wave_bounce(&waves[2]);
+    wave_noise(&waves[3]);
+    wave_clean(&waves[4], 16);
+
+    printf("%ld samples per waveform\n", ENCBENCH_SAMPLES);
+    printf("Encoder::update(), C path\n");
+    for (int i = 0; i < 5; i++)
+        run_encoder(&waves[i]);
+    printf("AxisAlly_QuadDecoder, no filter\n");
+    for (int i = 0; i < 5; i++)
+        run_decoder(&waves[i], 0);
+    printf("AxisAlly_QuadDecoder, 2us dwell\n");
+    for (int i = 0; i < 5; i++)
+        run_decoder(&waves[i], 2);
+
+    return 0;
+}
+
+#endif
+/* vim: set shiftwidth=4 expandtab:  */
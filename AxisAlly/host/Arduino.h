@@ -0,0 +1,46 @@
+/*
+ * Just enough of the Arduino core to build the PJRC Encoder library
+ * and AxisAlly_Encoder without it, for encbench.cpp: both encoder
+ * pins read one byte of RAM, encbench_port (bit 0 for pin 0, bit 1
+ * for pin 1), which the benchmark drives with synthetic waveforms.
+ *
+ * Not on the include path of anything else; the sketches get the real
+ * Arduino.h.
+ */
+
+#ifndef AXISALLY_HOST_ARDUINO_H
+#define AXISALLY_HOST_ARDUINO_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+
+#define INPUT           0
+#define INPUT_PULLUP    2
+#define HIGH            1
+
+extern volatile uint8_t encbench_port;
+
+#define digitalPinToPort(pin)           0
+#define portInputRegister(port)         (&encbench_port)
+#define digitalPinToBitMask(pin)        ((uint8_t)(1 << (pin)))
+
+/* direct_pin_read.h only knows the real boards */
+#ifndef __AVR__
+#define IO_REG_TYPE                     uint8_t
+#define PIN_TO_BASEREG(pin)             (portInputRegister(digitalPinToPort(pin)))
+#define PIN_TO_BITMASK(pin)             (digitalPinToBitMask(pin))
+#define DIRECT_PIN_READ(base, mask)     (((*(base)) & (mask)) ? 1 : 0)
+#endif
+
+static inline void pinMode(uint8_t pin, uint8_t mode) { }
+static inline void digitalWrite(uint8_t pin, uint8_t value) { }
+static inline void delayMicroseconds(unsigned int us) { }
+static inline unsigned long micros() { return 0; }
+static inline void noInterrupts() { }
+static inline void interrupts() { }
+
+#endif /* AXISALLY_HOST_ARDUINO_H */
+/* vim: set shiftwidth=4 expandtab:  */
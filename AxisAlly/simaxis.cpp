@@ -1,11 +1,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <AxisAlly.h>
 
 #include "SDL.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //----------------------------------------------------------
 
 // A set of very useful macros that you will find in most
@@ -386,6 +393,330 @@ static void line(SDL_Surface *s,
 
 //----------------------------------------------------------
 
+// Fill a run of 32 bit pixels with a single color. This is
+// where the polyline code below gets its speed: instead of
+// storing one pixel per Bresenham step, whole horizontal
+// runs are written 8 (AVX2) or 4 (SSE2) pixels at a time.
+// Unaligned stores are used because runs start anywhere
+// on the scan line. Whatever is left over is done one
+// pixel at a time, which is also the whole story on
+// machines with neither instruction set.
+
+static void span32(Uint32 *p, int n, Uint32 color)
+{
+#if defined(__AVX2__)
+  __m256i c8 = _mm256_set1_epi32(color);
+
+  for (; n >= 8; n -= 8, p += 8)
+  {
+    _mm256_storeu_si256((__m256i *)p, c8);
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i c4 = _mm_set1_epi32(color);
+
+  for (; n >= 4; n -= 4, p += 4)
+  {
+    _mm_storeu_si128((__m128i *)p, c4);
+  }
+#endif
+  while (n-- > 0)
+  {
+    *p++ = color;
+  }
+}
+
+//----------------------------------------------------------
+
+// Draw a line in a 32 bit surface as a series of runs
+// instead of a series of pixels. The pixels touched are
+// exactly the ones line32() touches; the difference is
+// that the Bresenham decision variable is advanced a whole
+// run at a time. In an x dominant line each run is a
+// horizontal span that goes to span32(). In a y dominant
+// line each run is a vertical span, which can't use
+// vector stores since every pixel is on a different scan
+// line, but still skips the per-pixel decision test.
+
+static void runs32(SDL_Surface *s,
+                   int x1, int y1,
+                   int x2, int y2,
+                   Uint32 color)
+{
+  int d;
+  int k;
+  int x;
+  int ax;
+  int ay;
+  int sx;
+  int sy;
+  int dx;
+  int dy;
+  int run;
+  int left;
+
+  Uint8 *lineAddr;
+  Sint32 yOffset;
+
+  dx = x2 - x1;
+  ax = abs(dx) << 1;
+  sx = sign(dx);
+
+  dy = y2 - y1;
+  ay = abs(dy) << 1;
+  sy = sign(dy);
+  yOffset = sy * s->pitch;
+
+  x = x1;
+
+  lineAddr = ((Uint8 *)(s->pixels)) + (y1 * s->pitch);
+  if (ax>ay)
+  {                      /* x dominant */
+    d = ay - (ax >> 1);
+    left = abs(dx) + 1;
+    for (;;)
+    {
+      // Number of extra steps before d goes non-negative
+      // and the line moves to the next scan line.
+
+      if (ay == 0)
+      {
+        k = left;
+      }
+      else
+      {
+        k = (d >= 0) ? 0 : (ay - 1 - d) / ay;
+      }
+      run = min(k + 1, left);
+
+      if (sx > 0)
+      {
+        span32((Uint32 *)(lineAddr + (x << 2)), run, color);
+      }
+      else
+      {
+        span32((Uint32 *)(lineAddr + ((x - run + 1) << 2)), run, color);
+      }
+
+      left -= run;
+      if (left == 0)
+      {
+        return;
+      }
+      x += run * sx;
+      d += k * ay - ax + ay;
+      lineAddr += yOffset;
+    }
+  }
+  else
+  {                      /* y dominant */
+    d = ax - (ay >> 1);
+    left = abs(dy) + 1;
+    for (;;)
+    {
+      if (ax == 0)
+      {
+        k = left;
+      }
+      else
+      {
+        k = (d >= 0) ? 0 : (ax - 1 - d) / ax;
+      }
+      run = min(k + 1, left);
+
+      left -= run;
+      while (run-- > 0)
+      {
+        *((Uint32 *)(lineAddr + (x << 2))) = color;
+        lineAddr += yOffset;
+      }
+
+      if (left == 0)
+      {
+        return;
+      }
+      x += sx;
+      d += k * ax - ay + ax;
+    }
+  }
+}
+
+//----------------------------------------------------------
+
+// Clip a line to the rectangle (0,0)-(maxx,maxy) using the
+// Cohen-Sutherland algorithm. Returns false if no part of
+// the line is visible. Integer arithmetic is used, so the
+// clipped end points can be off by a fraction of a pixel
+// from the true intersection, which nobody will notice.
+
+enum
+{
+  clipLeft   = 1,
+  clipRight  = 2,
+  clipTop    = 4,
+  clipBottom = 8
+};
+
+static int clipCode(int x, int y, int maxx, int maxy)
+{
+  int code = 0;
+
+  if (x < 0)
+  {
+    code |= clipLeft;
+  }
+  else if (x > maxx)
+  {
+    code |= clipRight;
+  }
+  if (y < 0)
+  {
+    code |= clipTop;
+  }
+  else if (y > maxy)
+  {
+    code |= clipBottom;
+  }
+
+  return code;
+}
+
+static bool clipLine(int &x1, int &y1,
+                     int &x2, int &y2,
+                     int maxx, int maxy)
+{
+  int c1 = clipCode(x1, y1, maxx, maxy);
+  int c2 = clipCode(x2, y2, maxx, maxy);
+
+  for (;;)
+  {
+    if (0 == (c1 | c2))
+    {
+      return true;
+    }
+    if (0 != (c1 & c2))
+    {
+      return false;
+    }
+
+    // Move whichever end point is outside onto the
+    // boundary it crosses. Wide intermediates keep the
+    // products from overflowing on far away points.
+
+    int c = c1 ? c1 : c2;
+    long long x;
+    long long y;
+
+    if (c & clipTop)
+    {
+      x = x1 + (long long)(x2 - x1) * (0 - y1) / (y2 - y1);
+      y = 0;
+    }
+    else if (c & clipBottom)
+    {
+      x = x1 + (long long)(x2 - x1) * (maxy - y1) / (y2 - y1);
+      y = maxy;
+    }
+    else if (c & clipLeft)
+    {
+      y = y1 + (long long)(y2 - y1) * (0 - x1) / (x2 - x1);
+      x = 0;
+    }
+    else
+    {
+      y = y1 + (long long)(y2 - y1) * (maxx - x1) / (x2 - x1);
+      x = maxx;
+    }
+
+    if (c == c1)
+    {
+      x1 = x;
+      y1 = y;
+      c1 = clipCode(x1, y1, maxx, maxy);
+    }
+    else
+    {
+      x2 = x;
+      y2 = y;
+      c2 = clipCode(x2, y2, maxx, maxy);
+    }
+  }
+}
+
+//----------------------------------------------------------
+
+// Draw a connected series of line segments, such as a
+// velocity or position history with one point per sample.
+// The bounding box of the whole polyline is checked once,
+// so the common case of a trace that is entirely on the
+// surface pays nothing for clipping. Only when part of it
+// is off the surface are the segments clipped one at a
+// time. On 32 bit surfaces the segments are drawn a run at
+// a time with runs32(), everything else falls back to the
+// per-pixel line() routines.
+
+struct polyPoint
+{
+  int x;
+  int y;
+};
+
+static void polyline(SDL_Surface *s,
+                     const polyPoint *p, int n,
+                     Uint32 color)
+{
+  int maxx = s->w - 1;
+  int maxy = s->h - 1;
+  int minX, maxX, minY, maxY;
+  bool clip;
+  int i;
+
+  if (n < 2)
+  {
+    return;
+  }
+
+  minX = maxX = p[0].x;
+  minY = maxY = p[0].y;
+  for (i = 1; i < n; i++)
+  {
+    minX = min(minX, p[i].x);
+    maxX = max(maxX, p[i].x);
+    minY = min(minY, p[i].y);
+    maxY = max(maxY, p[i].y);
+  }
+
+  if (minX > maxx || maxX < 0 || minY > maxy || maxY < 0)
+  {
+    return;
+  }
+  clip = (minX < 0 || maxX > maxx || minY < 0 || maxY > maxy);
+
+  for (i = 1; i < n; i++)
+  {
+    int x1 = p[i - 1].x;
+    int y1 = p[i - 1].y;
+    int x2 = p[i].x;
+    int y2 = p[i].y;
+
+    if (clip && !clipLine(x1, y1, x2, y2, maxx, maxy))
+    {
+      continue;
+    }
+
+    if (4 == s->format->BytesPerPixel)
+    {
+      runs32(s, x1, y1, x2, y2, color);
+    }
+    else
+    {
+      line(s, x1, y1, x2, y2, color);
+    }
+  }
+}
+
+//----------------------------------------------------------
+
 // sweepLine animates a line on a surface based on the
 // elapsed time.
 
@@ -401,6 +732,9 @@ private:
   int maxy;                   // Maximum valid Y value.
   int desired;
   float last_velocity;
+  polyPoint *trace;           // Speed history, one point
+                              // per column of the surface.
+  int traceLen;
 
 public:
 
@@ -454,9 +788,20 @@ public:
     axis->moveLocation(desired);
 
     last_velocity = 0;
+
+    // The speed history scrolls right to left across the
+    // whole width of the surface, starting out flat.
+
+    traceLen = maxx + 1;
+    trace = new polyPoint[traceLen];
+    for (int i = 0; i < traceLen; i++)
+    {
+      trace[i].x = i;
+      trace[i].y = maxy/2;
+    }
   }
 
-  ~simAxis() { delete axis; }
+  ~simAxis() { delete[] trace; delete axis; }
 
   void update(long now)
   {
@@ -492,6 +837,14 @@ public:
     // Draw the location line
     line(s, location, maxy/2 - velocity, location, maxy/2 + accel, red);
 
+    // Draw the speed history
+    for (int i = 1; i < traceLen; i++)
+    {
+      trace[i - 1].y = trace[i].y;
+    }
+    trace[traceLen - 1].y = maxy/2 - velocity;
+    polyline(s, trace, traceLen, green);
+
     last_velocity = velocity;
   }
 
@@ -572,6 +925,219 @@ public:
 
 //----------------------------------------------------------
 
+// benchLines compares drawing a long trace one line() call
+// per segment, which is how everything was drawn before
+// polyline() came along, against a single polyline() call.
+// The trace is a random walk with the given number of
+// samples spread across an offscreen 32 bit surface, so no
+// display is needed. Both paths must produce the same
+// pixels, which is checked before the timings are printed.
+
+static void benchLines(int samples, int frames)
+{
+  int w = 640;
+  int h = 480;
+  SDL_Surface *a;
+  SDL_Surface *b;
+  polyPoint *p;
+  Uint32 start;
+  Uint32 tLine;
+  Uint32 tPoly;
+  int i;
+  int f;
+
+  a = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+                           0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  b = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+                           0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  if (NULL == a || NULL == b)
+  {
+    printf("Can't create benchmark surfaces\n");
+    exit(1);
+  }
+
+  if (samples < 2)
+  {
+    samples = 2;
+  }
+
+  p = new polyPoint[samples];
+  p[0].x = 0;
+  p[0].y = h/2;
+  for (i = 1; i < samples; i++)
+  {
+    p[i].x = (long)i * (w - 1) / (samples - 1);
+    p[i].y = p[i - 1].y + (int)((drand48() - 0.5) * h / 4);
+    p[i].y = max(0, min(h - 1, p[i].y));
+  }
+
+  SDL_FillRect(a, NULL, 0);
+  start = SDL_GetTicks();
+  for (f = 0; f < frames; f++)
+  {
+    for (i = 1; i < samples; i++)
+    {
+      line(a, p[i - 1].x, p[i - 1].y, p[i].x, p[i].y, 0xffffff);
+    }
+  }
+  tLine = SDL_GetTicks() - start;
+
+  SDL_FillRect(b, NULL, 0);
+  start = SDL_GetTicks();
+  for (f = 0; f < frames; f++)
+  {
+    polyline(b, p, samples, 0xffffff);
+  }
+  tPoly = SDL_GetTicks() - start;
+
+  printf("%d samples x %d frames (%s stores)\n", samples, frames,
+#if defined(__AVX2__)
+         "AVX2"
+#elif defined(__SSE2__)
+         "SSE2"
+#else
+         "scalar"
+#endif
+         );
+  printf("  line32   %6u ms\n", tLine);
+  printf("  polyline %6u ms", tPoly);
+  if (tPoly > 0)
+  {
+    printf("  (%.2fx)", (double)tLine / tPoly);
+  }
+  printf("\n");
+  printf("  output   %s\n",
+         memcmp(a->pixels, b->pixels, h * a->pitch) ? "DIFFERS" : "identical");
+
+  delete[] p;
+  SDL_FreeSurface(a);
+  SDL_FreeSurface(b);
+}
+
+//----------------------------------------------------------
+
+// Headless rendering. Instead of opening a window, the
+// simulation is drawn into an offscreen surface and every
+// frame is appended to a YUV4MPEG2 (.y4m) stream. Y4M is
+// just a text header followed by raw planes, so it needs
+// no image library to write and any video tool can read
+// it, e.g. "ffmpeg -i out.y4m frame%04d.png" for a PNG
+// sequence. Time is simulated, not measured: frame n is
+// drawn at exactly n * 1000 / fps milliseconds and there
+// is no delay between frames, so a run takes as long as
+// the CPU needs and produces the same bytes every time.
+// (drand48() is never seeded, so the sequence of random
+// targets is the same from run to run.)
+
+static void writeY4MHeader(FILE *out, int w, int h, int fps)
+{
+  fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, fps);
+}
+
+// Convert a 32 bit surface to BT.601 studio range 4:4:4
+// planes using the usual 8 bit fixed point coefficients.
+
+static void writeY4MFrame(FILE *out, SDL_Surface *s, Uint8 *planes)
+{
+  SDL_PixelFormat *pf = s->format;
+  int n = s->w * s->h;
+  Uint8 *yp = planes;
+  Uint8 *up = planes + n;
+  Uint8 *vp = planes + 2 * n;
+  int x;
+  int y;
+
+  for (y = 0; y < s->h; y++)
+  {
+    Uint32 *row = (Uint32 *)(((Uint8 *)s->pixels) + (y * s->pitch));
+
+    for (x = 0; x < s->w; x++)
+    {
+      Uint32 p = row[x];
+      int r = (p & pf->Rmask) >> pf->Rshift;
+      int g = (p & pf->Gmask) >> pf->Gshift;
+      int b = (p & pf->Bmask) >> pf->Bshift;
+
+      *yp++ = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+      *up++ = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+      *vp++ = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+    }
+  }
+
+  fputs("FRAME\n", out);
+  fwrite(planes, 1, 3 * n, out);
+}
+
+static void renderHeadless(const char *path, int frames, int fps,
+                           int w, int h, float maxv, float maxa)
+{
+  SDL_Surface *s;
+  SDL_PixelFormat *pf;
+  simAxis *sa;
+  Uint8 *planes;
+  FILE *out;
+  int f;
+
+  if (fps <= 0)
+  {
+    fps = 60;
+  }
+
+  if (0 == strcmp(path, "-"))
+  {
+    out = stdout;
+  }
+  else
+  {
+    out = fopen(path, "wb");
+  }
+  if (NULL == out)
+  {
+    perror(path);
+    exit(1);
+  }
+
+  s = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+                           0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  if (NULL == s)
+  {
+    printf("Can't create offscreen surface\n");
+    exit(1);
+  }
+  pf = s->format;
+
+  planes = new Uint8[3 * w * h];
+
+  sa = new simAxis(s, maxv, maxa,
+                   SDL_MapRGB(pf, 0xff, 0x00, 0x00),
+                   SDL_MapRGB(pf, 0x00, 0xff, 0x00),
+                   SDL_MapRGB(pf, 0x00, 0x00, 0xff),
+                   0);
+
+  writeY4MHeader(out, w, h, fps);
+  for (f = 1; f <= frames; f++)
+  {
+    SDL_FillRect(s, NULL, SDL_MapRGB(pf, 0x00, 0x00, 0x00));
+    sa->update((long)f * 1000 / fps);
+    writeY4MFrame(out, s, planes);
+  }
+
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+  else
+  {
+    fflush(out);
+  }
+
+  delete sa;
+  delete[] planes;
+  SDL_FreeSurface(s);
+}
+
+//----------------------------------------------------------
+
 int main(int argc, char **argv)
 {
 
@@ -597,10 +1163,58 @@ int main(int argc, char **argv)
 
   simAxis *sa = NULL;
 
-  if (argc > 1)
-      maxv = strtod(argv[1], NULL);
-  if (argc > 2)
-      maxa = strtod(argv[2], NULL);
+  int opt;
+  const char *output = NULL;
+  int frames = 600;
+  int fps = 60;
+
+  // -b samples runs the line drawing benchmark with a
+  // trace of that many samples and exits.
+  //
+  // -o file renders headless to a .y4m file ("-" for
+  // stdout) instead of opening a window. -n sets the
+  // number of frames and -r the simulated frame rate.
+
+  while (-1 != (opt = getopt(argc, argv, "b:o:n:r:")))
+  {
+    switch (opt)
+    {
+    case 'b':
+      benchLines(atoi(optarg), 1000);
+      exit(0);
+
+    case 'o':
+      output = optarg;
+      break;
+
+    case 'n':
+      frames = atoi(optarg);
+      break;
+
+    case 'r':
+      fps = atoi(optarg);
+      break;
+
+    default:
+      printf("Usage: %s [-b samples] [-o out.y4m [-n frames] [-r fps]] [maxv [maxa]]\n", name);
+      exit(1);
+    }
+  }
+
+  if (argc > optind)
+      maxv = strtod(argv[optind], NULL);
+  if (argc > optind + 1)
+      maxa = strtod(argv[optind + 1], NULL);
+
+  // Headless rendering never touches the video subsystem,
+  // so it works on machines without a display.
+
+  if (NULL != output)
+  {
+    renderHeadless(output, frames, fps,
+                   screenWidth, screenHeight, maxv, maxa);
+    exit(0);
+  }
 
   // Try to initialize SDL. If it fails, then give up.
 
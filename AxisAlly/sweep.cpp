@@ -0,0 +1,390 @@
+/*
+ * Parameter sweep for AxisAlly_Sim
+ *
+ * Evaluates a grid (or Latin hypercube) of velocity limit, acceleration
+ * limit and braking margin settings against the same scripted list of
+ * moves, and prints the Pareto front of average move time against worst
+ * overshoot.
+ *
+ * Points are spread over a pool of worker threads, one per core by
+ * default. Each worker runs SWEEP_BATCH points at a time in one
+ * AxisAlly_SimBatch, so a tick of all of them is one vectorized loop;
+ * -S runs every point on its own AxisAlly_Sim instead, which gives the
+ * same results, to compare against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <AxisAlly.h>
+#include <AxisAlly_SimBatch.h>
+
+#define SWEEP_BATCH     64      /* Points per worker's AxisAlly_SimBatch */
+
+struct sweep_range {
+    float min;
+    float max;
+};
+
+struct sweep_point {
+    float velocity_max;
+    float acceleration_max;
+    float brake_margin;
+
+    float move_time;        /* Average seconds per move */
+    float overshoot;        /* Worst overshoot, in location units */
+    int   stalled;          /* Moves that never finished */
+};
+
+struct sweep_config {
+    int   location_max;     /* Moves go between 0 and this */
+    long  tick_ms;          /* Simulated loop period */
+    float timeout;          /* Give up on a move after this many seconds */
+    std::vector<int> moves; /* Scripted move targets */
+};
+
+/* Run every scripted move on a fresh axis
+ */
+static void sweep_eval(const sweep_config &cfg, sweep_point &pt)
+{
+    AxisAlly_Sim sim;
+    AxisAlly &axis = sim;
+    long max_ticks = (long)(cfg.timeout * 1000.0 / cfg.tick_ms);
+    double total_time = 0;
+
+    axis.setLocationRange(0, cfg.location_max);
+    axis.setVelocityMax(pt.velocity_max);
+    axis.setAccelerationMax(pt.acceleration_max);
+    sim.setBrakeMargin(pt.brake_margin);
+    axis.setLocation(0);
+    axis.begin();
+
+    pt.overshoot = 0;
+    pt.stalled = 0;
+
+    for (size_t i = 0; i < cfg.moves.size(); i++) {
+        int target = cfg.moves[i];
+        int dir = (target < axis.getLocation()) ? -1 : 1;
+        long ticks;
+
+        axis.moveLocation(target);
+        for (ticks = 0; ticks < max_ticks; ticks++) {
+            bool moving = axis.update(cfg.tick_ms);
+            float past = dir * (axis.getLocation() - target);
+
+            if (past > pt.overshoot)
+                pt.overshoot = past;
+            if (!moving)
+                break;
+        }
+
+        if (ticks == max_ticks)
+            pt.stalled++;
+        total_time += ticks * cfg.tick_ms / 1000.0;
+    }
+
+    pt.move_time = total_time / cfg.moves.size();
+}
+
+/* Run every scripted move on every point, SWEEP_BATCH at a time
+ *   Each lane of the batch takes the next unevaluated point from next
+ *   and starts it from rest at 0, as sweep_eval() would; a point starts
+ *   its next move as soon as it finishes the last, and once it has run
+ *   them all, its lane takes another point. A tick's delta is always
+ *   the same, so the batch's shared loop period is each point's own.
+ */
+static void sweep_eval_batch(const sweep_config &cfg,
+                             std::vector<sweep_point> &pts,
+                             std::atomic<size_t> &next)
+{
+    AxisAlly_SimBatch batch(SWEEP_BATCH);
+    int max_ticks = (int)(cfg.timeout * 1000.0 / cfg.tick_ms);
+    sweep_point *lane[SWEEP_BATCH];
+    size_t move[SWEEP_BATCH];
+    int ticks[SWEEP_BATCH];
+    int done[SWEEP_BATCH];
+    int target[SWEEP_BATCH];
+    int dir[SWEEP_BATCH];
+    float overshoot[SWEEP_BATCH];
+    double total_time[SWEEP_BATCH];
+    int running = 0;
+
+    for (int i = 0; i < SWEEP_BATCH; i++) {
+        lane[i] = 0;
+        dir[i] = 0;
+        target[i] = 0;
+        ticks[i] = 0;
+        overshoot[i] = 0;
+        batch.setLocationRange(i, 0, cfg.location_max);
+        batch.stopAt(i, 0);
+    }
+
+    for (;;) {
+        /* Idle lanes take new points */
+        for (int i = 0; i < SWEEP_BATCH; i++) {
+            sweep_point *pt;
+            size_t p;
+
+            if (lane[i] || (p = next++) >= pts.size())
+                continue;
+            pt = lane[i] = &pts[p];
+            running++;
+
+            batch.setVelocityMax(i, pt->velocity_max);
+            batch.setAccelerationMax(i, pt->acceleration_max);
+            batch.setBrakeMargin(i, pt->brake_margin);
+            batch.stopAt(i, 0);
+            pt->stalled = 0;
+
+            move[i] = 0;
+            ticks[i] = 0;
+            overshoot[i] = 0;
+            total_time[i] = 0;
+            target[i] = cfg.moves[0];
+            dir[i] = target[i] < 0 ? -1 : 1;
+            batch.moveLocation(i, target[i]);
+        }
+        if (!running)
+            break;
+
+        batch.update(cfg.tick_ms);
+
+        /* Without branches, so it vectorizes like the update; idle
+         * lanes have dir 0 and never move
+         */
+        for (int i = 0; i < SWEEP_BATCH; i++) {
+            float past = dir[i] * (batch.getLocation(i) - target[i]);
+            int moving = batch.isMoving(i);
+
+            overshoot[i] = past > overshoot[i] ? past : overshoot[i];
+            ticks[i] += moving;
+            done[i] = !moving | (ticks[i] >= max_ticks);
+        }
+
+        for (int i = 0; i < SWEEP_BATCH; i++) {
+            sweep_point *pt = lane[i];
+
+            if (!done[i] || !pt)
+                continue;
+            if (ticks[i] == max_ticks)
+                pt->stalled++;
+            total_time[i] += ticks[i] * cfg.tick_ms / 1000.0;
+
+            ticks[i] = 0;
+            if (++move[i] == cfg.moves.size()) {
+                pt->move_time = total_time[i] / cfg.moves.size();
+                pt->overshoot = overshoot[i];
+                lane[i] = 0;
+                dir[i] = 0;
+                running--;
+                batch.stopAt(i, 0);
+                continue;
+            }
+            target[i] = cfg.moves[move[i]];
+            dir[i] = (target[i] < batch.getLocation(i)) ? -1 : 1;
+            batch.moveLocation(i, target[i]);
+        }
+    }
+}
+
+/* Pick evenly spaced values along one range
+ */
+static float sweep_step(const sweep_range &r, int i, int n)
+{
+    if (n < 2)
+        return r.min;
+    return r.min + (r.max - r.min) * i / (n - 1);
+}
+
+/* n^3 points, evenly spaced along each range */
+static void sweep_grid(std::vector<sweep_point> &pts, int n,
+                       const sweep_range &v, const sweep_range &a,
+                       const sweep_range &k)
+{
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            for (int l = 0; l < n; l++) {
+                sweep_point pt;
+
+                memset(&pt, 0, sizeof(pt));
+                pt.velocity_max = sweep_step(v, i, n);
+                pt.acceleration_max = sweep_step(a, j, n);
+                pt.brake_margin = sweep_step(k, l, n);
+                pts.push_back(pt);
+            }
+        }
+    }
+}
+
+/* n points, one in each of n strata along every range */
+static void sweep_lhs(std::vector<sweep_point> &pts, int n,
+                      const sweep_range &v, const sweep_range &a,
+                      const sweep_range &k, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> u(0.0, 1.0);
+    std::vector<int> sv(n), sa(n), sk(n);
+
+    for (int i = 0; i < n; i++)
+        sv[i] = sa[i] = sk[i] = i;
+    std::shuffle(sv.begin(), sv.end(), rng);
+    std::shuffle(sa.begin(), sa.end(), rng);
+    std::shuffle(sk.begin(), sk.end(), rng);
+
+    for (int i = 0; i < n; i++) {
+        sweep_point pt;
+
+        memset(&pt, 0, sizeof(pt));
+        pt.velocity_max = v.min + (v.max - v.min) * (sv[i] + u(rng)) / n;
+        pt.acceleration_max = a.min + (a.max - a.min) * (sa[i] + u(rng)) / n;
+        pt.brake_margin = k.min + (k.max - k.min) * (sk[i] + u(rng)) / n;
+        pts.push_back(pt);
+    }
+}
+
+static bool sweep_faster(const sweep_point &a, const sweep_point &b)
+{
+    if (a.move_time != b.move_time)
+        return a.move_time < b.move_time;
+    return a.overshoot < b.overshoot;
+}
+
+static void sweep_print(const sweep_point &pt, bool front)
+{
+    printf("%c %8.3f %10.3f %8.3f %10.4f %10.3f %5d\n",
+           front ? '*' : ' ', pt.velocity_max, pt.acceleration_max,
+           pt.brake_margin, pt.move_time, pt.overshoot, pt.stalled);
+}
+
+static bool parse_range(const char *arg, sweep_range &r)
+{
+    char *end;
+
+    r.min = strtod(arg, &end);
+    if (*end != ':')
+        return false;
+    r.max = strtod(end + 1, &end);
+    return *end == 0 && r.max >= r.min;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -j threads  worker threads (default: one per core)\n"
+            "  -n count    grid steps per parameter, or LHS samples\n"
+            "  -l          Latin hypercube instead of a grid\n"
+            "  -m moves    scripted moves per point (default 1000)\n"
+            "  -s seed     seed for the moves and the hypercube\n"
+            "  -t ms       simulated loop period (default 10)\n"
+            "  -v min:max  velocity limit range\n"
+            "  -a min:max  acceleration limit range\n"
+            "  -k min:max  braking margin range\n"
+            "  -A          print every point, not just the Pareto front\n"
+            "  -S          one AxisAlly_Sim per point, not batched\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    sweep_range v = { 50.0, 500.0 };
+    sweep_range a = { 5.0, 200.0 };
+    sweep_range k = { 1.0, 2.0 };
+    int threads = std::thread::hardware_concurrency();
+    int count = 10;
+    int moves = 1000;
+    unsigned seed = 1;
+    bool lhs = false;
+    bool all = false;
+    bool single = false;
+    sweep_config cfg;
+    std::vector<sweep_point> pts;
+    int opt;
+
+    cfg.location_max = 640;
+    cfg.tick_ms = 10;
+    cfg.timeout = 60.0;
+
+    while ((opt = getopt(argc, argv, "j:n:lm:s:t:v:a:k:AS")) != -1) {
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'l': lhs = true; break;
+        case 'm': moves = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 't': cfg.tick_ms = atol(optarg); break;
+        case 'v': if (!parse_range(optarg, v)) usage(argv[0]); break;
+        case 'a': if (!parse_range(optarg, a)) usage(argv[0]); break;
+        case 'k': if (!parse_range(optarg, k)) usage(argv[0]); break;
+        case 'A': all = true; break;
+        case 'S': single = true; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (count < 1 || moves < 1 || cfg.tick_ms < 1)
+        usage(argv[0]);
+
+    /* Same script for every point, so the results are comparable */
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> target(0, cfg.location_max);
+    for (int i = 0; i < moves; i++)
+        cfg.moves.push_back(target(rng));
+
+    if (lhs)
+        sweep_lhs(pts, count, v, a, k, rng);
+    else
+        sweep_grid(pts, count, v, a, k);
+
+    /* Workers pull the next unevaluated point until none are left */
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(std::thread([&]() {
+            size_t i;
+
+            if (!single) {
+                sweep_eval_batch(cfg, pts, next);
+                return;
+            }
+            while ((i = next++) < pts.size())
+                sweep_eval(cfg, pts[i]);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+
+    std::sort(pts.begin(), pts.end(), sweep_faster);
+
+    fprintf(stderr, "%zu points x %d moves on %d threads\n",
+            pts.size(), moves, threads);
+    printf("# %8s %10s %8s %10s %10s %5s\n",
+           "vmax", "amax", "brake", "time(s)", "overshoot", "stall");
+
+    /* Sorted by move time, a point is on the front if it overshoots
+     * less than every faster point. Front points are marked with '*'.
+     */
+    float best = INFINITY;
+    for (size_t i = 0; i < pts.size(); i++) {
+        bool front = pts[i].stalled == 0 && pts[i].overshoot < best;
+
+        if (front)
+            best = pts[i].overshoot;
+        if (front || all)
+            sweep_print(pts[i], front);
+    }
+
+    return 0;
+}
+/* vim: set shiftwidth=4 expandtab:  */
@@ -1,7 +1,1916 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include <string>
+#include <vector>
 
 #include <AxisAlly.h>
+#include <AxisAlly_SimBatch.h>
+
+/* Stand-ins for the Arduino core and motor libraries, driving a
+ * simulated DC motor, for the hardware backends.
+ */
+#define FORWARD         1
+#define BACKWARD        2
+#define BRAKE           3
+#define RELEASE         4
+#define SINGLE          1
+#define DOUBLE          2
+#define INPUT_PULLUP    2
+#define ENDSTOP_PIN     41
+
+/* A geared DC motor: no motion below PWM 60, a 50ms time constant,
+ * and hard stops at -500 and 10000 counts. Backward is slower by the
+ * fraction drag, if set. An endstop switch on
+ * ENDSTOP_PIN closes at stop_max counts (if set), calling isr. The
+ * carriage (load) follows the motor through a gap of backlash counts.
+ * With age, the motor loses the fraction weak of its speed and takes
+ * inertia seconds longer to get up to it.
+ */
+static struct {
+    double position;
+    double velocity;
+    int pwm;
+    int dir;
+    long offset;
+    unsigned long us;
+    double drag;
+    long writes;            /* setSpeed() and run() calls */
+    double stop_max;
+    void (*isr)();
+    double load;
+    double backlash;
+    long load_offset;
+    double weak;
+    double inertia;
+    void (*interrupt)();    /* Once, just before the next setSpeed() */
+} dc;
+
+static int dc_endstop()
+{
+    return dc.stop_max && dc.position >= dc.stop_max;
+}
+
+static void dc_run(long us)
+{
+    for (; us > 0; us -= 100) {
+        double sec = 0.0001;
+        double target = dc.pwm > 60 ? (dc.pwm - 60) * 15.0 : 0.0;
+        int endstop = dc_endstop();
+
+        if (dc.dir == BACKWARD)
+            target = -target * (1.0 - dc.drag);
+        else if (dc.dir != FORWARD)
+            target = 0.0;
+        target *= 1.0 - dc.weak;
+
+        dc.velocity += (target - dc.velocity) * sec / (0.05 + dc.inertia);
+        dc.position += dc.velocity * sec;
+        if (dc.position < -500 || dc.position > 10000) {
+            dc.position = dc.position < 0 ? -500 : 10000;
+            dc.velocity = 0;
+        }
+        if (dc.position - dc.load > dc.backlash / 2)
+            dc.load = dc.position - dc.backlash / 2;
+        else if (dc.load - dc.position > dc.backlash / 2)
+            dc.load = dc.position + dc.backlash / 2;
+        dc.us += 100;
+        if (dc.isr && dc_endstop() != endstop)
+            dc.isr();
+    }
+}
+
+static unsigned long millis() { dc_run(1000); return dc.us / 1000; }
+static void delay(unsigned long ms) { dc_run(ms * 1000); }
+static void delayMicroseconds(unsigned int us) { dc_run(us); }
+static int digitalRead(int pin) { return pin == ENDSTOP_PIN && dc_endstop(); }
+static void pinMode(int pin, int mode) { }
+static void noInterrupts() { }
+static void interrupts() { }
+
+struct MockMotor {
+    void setSpeed(int pwm) {
+        void (*interrupt)() = dc.interrupt;
+
+        dc.interrupt = NULL;
+        if (interrupt)
+            interrupt();
+        dc.pwm = pwm;
+        dc.writes++;
+    }
+    void run(int dir) { dc.dir = dir; dc.writes++; }
+};
+
+struct MockEncoder {
+    long read() { return (long)floor(dc.position) + dc.offset; }
+    void write(long count) { dc.offset = count - (long)floor(dc.position); }
+};
+
+struct MockLoadEncoder {
+    long read() { return (long)floor(dc.load) + dc.load_offset; }
+    void write(long count) { dc.load_offset = count - (long)floor(dc.load); }
+};
+
+struct MockEEPROM {
+    unsigned char bytes[256];
+    unsigned long wear[256];            /* Writes to each byte */
+    unsigned char read(int address) { return bytes[address]; }
+    void write(int address, unsigned char value) {
+        bytes[address] = value;
+        wear[address]++;
+    }
+};
+
+/* A PCA9685 on I2C: the first byte of each write picks the register,
+ * and the rest auto-increment from there.
+ */
+struct MockWire {
+    unsigned char regs[256];
+    unsigned char buffer[64];
+    int length;
+    int transfers;
+    int longest;
+
+    void beginTransmission(int address) { length = 0; }
+    void write(int value) { buffer[length++] = value; }
+    int endTransmission() {
+        for (int i = 1; i < length; i++)
+            regs[buffer[0] + i - 1] = buffer[i];
+        transfers++;
+        if (length > longest)
+            longest = length;
+        return 0;
+    }
+    /* Channel as on, off counts */
+    int on(int channel) {
+        return regs[6 + 4 * channel] | regs[7 + 4 * channel] << 8;
+    }
+    int off(int channel) {
+        return regs[8 + 4 * channel] | regs[9 + 4 * channel] << 8;
+    }
+};
+
+struct MockStepper {
+    int position;
+    int steps;
+    int onestep(int dir, int style) {
+        position += (dir == FORWARD) ? 1 : -1;
+        steps++;
+        return 0;
+    }
+};
+
+/* Profiling on, timed in simulated microseconds */
+#define AXISALLY_PROFILE
+#define AXISALLY_PROFILE_CLOCK  MockProfileClock
+
+struct MockProfileClock {
+    typedef unsigned long ticks;
+
+    static void setup() { }
+    static ticks now() { return dc.us; }
+    static unsigned long perMicro() { return 1; }
+};
+
+#include <AxisAlly_DCEncoder.h>
+#include <AxisAlly_Stepper.h>
+#include <AxisAlly_MotorShield2.h>
+#include <AxisAlly_TWI.h>
+#include <AxisAlly_LCD.h>
+#include <AxisAlly_Scheduler.h>
+#include <AxisAlly_Encoder.h>
+#include <AxisAlly_Config.h>
+
+static int failures;
+
+#define CHECK(cond, f, args...) do { \
+        if (!(cond)) { \
+            failures++; \
+            printf("FAIL %s:%d: " f "\n", __FILE__, __LINE__ ,##args ); \
+        } \
+    } while (0)
+
+/* The batch must track a set of AxisAlly_Sim objects given the same
+ * limits, targets and (jittery) loop times exactly.
+ */
+static void test_batch_matches_sim()
+{
+    const int axes = 257;
+    AxisAlly_SimBatch batch(axes);
+    AxisAlly_Sim *sim = new AxisAlly_Sim[axes];
+    int mismatched = 0;
+
+    srand48(42);
+    for (int i = 0; i < axes; i++) {
+        AxisAlly &axis = sim[i];
+        int lo = -(int)(drand48() * 1000);
+        int hi = (int)(drand48() * 1000);
+        float vmax = 10.0 + drand48() * 500.0;
+        float amax = 1.0 + drand48() * 200.0;
+        float margin = 0.8 + drand48();
+
+        axis.setLocationRange(lo, hi);
+        batch.setLocationRange(i, lo, hi);
+        axis.setVelocityMax(vmax);
+        batch.setVelocityMax(i, vmax);
+        axis.setAccelerationMax(amax);
+        batch.setAccelerationMax(i, amax);
+        sim[i].setBrakeMargin(margin);
+        batch.setBrakeMargin(i, margin);
+        axis.setLocation(0);
+        batch.setLocation(i, 0);
+    }
+
+    for (int step = 0; step < 20000; step++) {
+        long dt = 1 + (long)(drand48() * 20);
+        int moving = 0;
+
+        for (int i = 0; i < axes; i++) {
+            /* New target whenever an axis stops, sometimes out of range */
+            if (!batch.isMoving(i) && drand48() < 0.1) {
+                int target = (int)((drand48() - 0.5) * 2500);
+                sim[i].moveLocation(target);
+                batch.moveLocation(i, target);
+            }
+        }
+
+        for (int i = 0; i < axes; i++)
+            moving += sim[i].update(dt);
+        CHECK(batch.update(dt) == moving, "step %d: moving count", step);
+
+        for (int i = 0; i < axes; i++) {
+            AxisAlly &axis = sim[i];
+            float v = axis.getVelocity();
+            float bv = batch.getVelocity(i);
+
+            if (axis.getLocation() != batch.getLocation(i) ||
+                memcmp(&v, &bv, sizeof(v)) != 0)
+                mismatched++;
+        }
+    }
+
+    CHECK(mismatched == 0, "%d axis-steps differ from AxisAlly_Sim", mismatched);
+
+    delete[] sim;
+}
+
+/* With dt anywhere from 0.1ms to 20ms, every tick must respect the
+ * velocity and acceleration limits, and moves must still finish.
+ */
+static void test_profile_random_dt()
+{
+    AxisAlly_SimStatic sim;
+    const float vmax = 500.0, amax = 2000.0;
+    float worst_v = 0, worst_a = 0;
+    int moves = 0;
+
+    sim.setLocationRange(0, 10000);
+    sim.setVelocityMax(vmax);
+    sim.setAccelerationMax(amax);
+    sim.setLocation(0);
+
+    srand48(7);
+    for (int step = 0; step < 200000; step++) {
+        long dt_us = 100 + (long)(drand48() * 19900);
+        float v0 = sim.getVelocity();
+        float v, a;
+
+        if (!sim.updateMicros(dt_us)) {
+            sim.moveLocation((int)(drand48() * 10000));
+            moves++;
+        }
+
+        /* Allow for float rounding of v near vmax */
+        v = fabsf(sim.getVelocity());
+        a = (fabsf(sim.getVelocity() - v0) - vmax * FLT_EPSILON) /
+            (dt_us / 1000000.0);
+        if (v > worst_v)
+            worst_v = v;
+        if (a > worst_a)
+            worst_a = a;
+    }
+
+    CHECK(worst_v <= vmax * 1.0001, "velocity %f over limit %f", worst_v, vmax);
+    CHECK(worst_a <= amax * 1.0001, "acceleration %f over limit %f", worst_a, amax);
+    CHECK(moves > 100, "only %d moves finished", moves);
+}
+
+/* One long stall shouldn't drag the period estimate, but should
+ * show up in the jitter.
+ */
+static void test_loop_outlier()
+{
+    AxisAlly_LoopStats loop;
+
+    srand48(3);
+    for (int i = 0; i < 1000; i++)
+        loop.update(9500 + (long)(drand48() * 1000));
+    CHECK(fabsf(loop.average() - 0.010) < 0.0002, "period %f", loop.average());
+    CHECK(loop.jitter() > 0.0001 && loop.jitter() < 0.0005,
+          "jitter %f", loop.jitter());
+
+    loop.update(500000);
+    CHECK(fabsf(loop.average() - 0.010) < 0.001,
+          "period %f after outlier", loop.average());
+}
+
+/* With 30 counts of backlash, the motor encoder alone leaves the
+ * carriage short after every reversal; with a carriage encoder the
+ * gap is learnt and taken up
+ */
+static void test_dcencoder_backlash()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    MockLoadEncoder load;
+    AxisAlly_DCEncoder<MockMotor, MockEncoder, MockLoadEncoder> dcaxis(&motor, &encoder);
+    AxisAlly &axis = dcaxis;
+    int targets[] = { 4000, 1000, 1020, 3000, 2000, 2500, 2480 };
+    int single_ticks = 0, dual_ticks = 0;
+    long worst;
+
+    dc.backlash = 30;
+
+    /* Single loop: off by the gap after the first reversal */
+    dcaxis.setHoming(150, 0);
+    dcaxis.setDeadband(3);
+    dcaxis.setFullSpeed(2925);
+    axis.setLocationRange(0, 9000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+    load.write(0);
+
+    worst = 0;
+    for (unsigned i = 0; i < sizeof(targets)/sizeof(targets[0]); i++) {
+        int ticks;
+
+        axis.moveLocation(targets[i]);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            dc_run(10000);
+            if (!axis.update(10))
+                break;
+        }
+        single_ticks += ticks;
+        if (labs(load.read() - targets[i]) > worst)
+            worst = labs(load.read() - targets[i]);
+    }
+    CHECK(worst >= 25, "single loop carriage only %ld out", worst);
+
+    /* Dual loop */
+    dcaxis.setLoadEncoder(&load);
+    axis.begin();
+
+    worst = 0;
+    for (unsigned i = 0; i < sizeof(targets)/sizeof(targets[0]); i++) {
+        int ticks;
+
+        axis.moveLocation(targets[i]);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            dc_run(10000);
+            if (!axis.update(10))
+                break;
+        }
+        CHECK(ticks < 1000, "dual loop move to %d never finished",
+              targets[i]);
+        dual_ticks += ticks;
+        if (labs(load.read() - targets[i]) > worst)
+            worst = labs(load.read() - targets[i]);
+        CHECK(abs(axis.getLocation() - targets[i]) <= 3,
+              "move to %d left the carriage at %d", targets[i],
+              axis.getLocation());
+    }
+    CHECK(fabsf(dcaxis.getBacklash() - 30) < 3, "backlash %f, not 30",
+          dcaxis.getBacklash());
+    /* Learning the gap takes a while, once; then it's as quick */
+    CHECK(dual_ticks < single_ticks * 3 / 2, "dual loop took %d ticks, "
+          "single %d", dual_ticks, single_ticks);
+
+    /* Known, it costs nothing more to reverse */
+    single_ticks = dual_ticks = 0;
+    for (int k = 0; k < 2; k++) {
+        int ticks;
+
+        axis.moveLocation(k ? 2500 : 2000);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            dc_run(10000);
+            if (!axis.update(10))
+                break;
+        }
+        dual_ticks += ticks;
+        CHECK(abs(axis.getLocation() - (k ? 2500 : 2000)) <= 3,
+              "reversal to %d left the carriage at %d", k ? 2500 : 2000,
+              axis.getLocation());
+    }
+    CHECK(dual_ticks < 200, "two reversals took %d ticks", dual_ticks);
+
+    dc.backlash = 0;
+}
+
+/* Over a few hundred moves the motor loses 30% of its speed and
+ * triples its time constant, with or without adaptive gains. Reports
+ * the worst overshoot and move time, and how many times the axis
+ * crossed its target, over the second half.
+ */
+static void run_drifting(bool adaptive, int *worst_overshoot,
+                         int *worst_ticks, int *crossings)
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    AxisAlly_DCEncoder<MockMotor, MockEncoder> dcaxis(&motor, &encoder);
+    AxisAlly &axis = dcaxis;
+    AxisAlly_GainAdapt adapt;
+    int targets[] = { 1000, 8000, 3000, 6500, 2000, 7500 };
+    const int moves = 240;
+    float kp0 = 0.01782, ki0 = 0.00085, kp_last = kp0;
+
+    dc.weak = 0.0;
+    dc.inertia = 0.0;
+    dcaxis.setHoming(150, 0);
+    dcaxis.setDeadband(3);
+    dcaxis.setFullSpeed(2925);
+    dcaxis.setGains(kp0, ki0);
+    dcaxis.setStallDetect(0, 0);
+    axis.setLocationRange(0, 9000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+    if (adaptive)
+        dcaxis.setAdaptive(&adapt);
+
+    *worst_overshoot = 0;
+    *worst_ticks = 0;
+    *crossings = 0;
+    for (int i = 0; i < moves; i++) {
+        int target = targets[i % 6];
+        int dir = target < axis.getLocation() ? -1 : 1;
+        int overshoot = 0, ticks, side = 0, crossed = 0;
+
+        dc.weak = 0.3 * i / moves;
+        dc.inertia = 0.1 * i / moves;
+        axis.moveLocation(target);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            int error;
+
+            dc_run(10000);
+            if (!axis.update(10))
+                break;
+            error = axis.getLocation() - target;
+            if (dir * error > overshoot)
+                overshoot = dir * error;
+            if (error && side && (error < 0) != (side < 0))
+                crossed++;
+            if (error)
+                side = error;
+
+            if (!adaptive)
+                continue;
+            /* 10% a second, at most one fit a tick */
+            CHECK(adapt.getKp() <= kp_last * 1.0021 &&
+                  adapt.getKp() >= kp_last * 0.9979,
+                  "kp went from %f to %f at once", kp_last, adapt.getKp());
+            CHECK(adapt.getKp() <= kp0 * 4.0001 &&
+                  adapt.getKp() >= kp0 / 4.0001,
+                  "kp %f out of bounds", adapt.getKp());
+            kp_last = adapt.getKp();
+        }
+
+        CHECK(ticks < 1000, "move %d to %d never finished", i, target);
+        CHECK(abs(axis.getLocation() - target) <= 3,
+              "move %d to %d ended at %d", i, target, axis.getLocation());
+        CHECK(overshoot < 50, "move %d to %d overshot by %d",
+              i, target, overshoot);
+        /* Once it has drifted a way, not while learning */
+        if (i >= moves / 2) {
+            if (overshoot > *worst_overshoot)
+                *worst_overshoot = overshoot;
+            if (ticks > *worst_ticks)
+                *worst_ticks = ticks;
+            *crossings += crossed;
+        }
+    }
+    CHECK(dcaxis.getFault() == AXISALLY_FAULT_NONE,
+          "fault %d while drifting", dcaxis.getFault());
+
+    if (adaptive) {
+        /* Speed is (pwm - 60) * 15 * (1 - weak), PWM 80 + 175 * output */
+        float gain = 2625 * (1.0 - dc.weak), tau = 0.05 + dc.inertia;
+        float kp = kp0 * 2625 / gain;
+
+        CHECK(fabsf(adapt.getGain() - gain) < 0.1 * gain,
+              "estimated gain %f, not %f", adapt.getGain(), gain);
+        CHECK(fabsf(adapt.getTimeConstant() - tau) < 0.2 * tau,
+              "estimated time constant %f, not %f",
+              adapt.getTimeConstant(), tau);
+        CHECK(fabsf(adapt.getKp() - kp) < 0.15 * kp,
+              "kp %f, not near %f", adapt.getKp(), kp);
+        CHECK(fabsf(adapt.getKi() / adapt.getKp() - ki0 / kp0) < 0.01 * ki0 / kp0,
+              "ki %f out of step with kp %f", adapt.getKi(), adapt.getKp());
+    }
+    dc.weak = 0.0;
+    dc.inertia = 0.0;
+}
+
+/* Adaptive gains do no worse than fixed ones on a drifting motor */
+static void test_dcencoder_adapt()
+{
+    int fixed_overshoot, fixed_ticks, fixed_crossings;
+    int adapt_overshoot, adapt_ticks, adapt_crossings;
+
+    run_drifting(false, &fixed_overshoot, &fixed_ticks, &fixed_crossings);
+    run_drifting(true, &adapt_overshoot, &adapt_ticks, &adapt_crossings);
+
+    CHECK(adapt_ticks <= fixed_ticks, "adaptive moves took up to %d ticks, "
+          "fixed %d", adapt_ticks, fixed_ticks);
+    CHECK(adapt_crossings <= fixed_crossings, "adaptive gains rang %d "
+          "times, fixed %d", adapt_crossings, fixed_crossings);
+    CHECK(adapt_overshoot <= fixed_overshoot * 3 / 2, "adaptive gains "
+          "overshot by %d, fixed %d", adapt_overshoot, fixed_overshoot);
+}
+
+/* Home against the hard stop, then make a few moves
+ */
+static void test_dcencoder_moves()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    AxisAlly_DCEncoder<MockMotor, MockEncoder> dcaxis(&motor, &encoder);
+    AxisAlly &axis = dcaxis;
+    int targets[] = { 4000, 1000, 1020, 8000, 0 };
+
+    dcaxis.setHoming(150, 0);
+    dcaxis.setDeadband(3);
+    dcaxis.setFullSpeed(2925);
+    axis.setLocationRange(0, 9000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+
+    CHECK(dc.position == -500, "homed at %f, not the hard stop", dc.position);
+    CHECK(axis.getLocation() == 0, "home is %d", axis.getLocation());
+
+    for (unsigned i = 0; i < sizeof(targets)/sizeof(targets[0]); i++) {
+        int target = targets[i];
+        int dir = target < axis.getLocation() ? -1 : 1;
+        int overshoot = 0;
+        int ticks;
+
+        axis.moveLocation(target);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            dc_run(10000);
+            if (!axis.update(10))
+                break;
+            if (dir * (axis.getLocation() - target) > overshoot)
+                overshoot = dir * (axis.getLocation() - target);
+        }
+
+        CHECK(ticks < 1000, "move to %d never finished", target);
+        CHECK(abs(axis.getLocation() - target) <= 3,
+              "move to %d ended at %d", target, axis.getLocation());
+        CHECK(overshoot < 50, "move to %d overshot by %d", target, overshoot);
+    }
+
+    CHECK(dcaxis.getFault() == AXISALLY_FAULT_NONE,
+          "fault %d on ordinary moves", dcaxis.getFault());
+
+    /* Only changes reach the motor */
+    dc.writes = 0;
+    for (int ticks = 0; ticks < 10; ticks++) {
+        dc_run(10000);
+        axis.update(10);
+    }
+    CHECK(dc.writes == 0, "%ld motor writes while holding", dc.writes);
+
+    axis.moveLocation(4000);
+    for (int ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    /* The PWM changes most updates; the direction only at the ends */
+    CHECK(dc.writes < 200, "%ld motor writes for one move", dc.writes);
+}
+
+/* Drive into the hard stop, with and without a following error limit
+ */
+static void test_dcencoder_stall()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    AxisAlly_DCEncoder<MockMotor, MockEncoder> dcaxis(&motor, &encoder);
+    AxisAlly &axis = dcaxis;
+    int ticks;
+
+    dcaxis.setHoming(150, 0);
+    dcaxis.setFullSpeed(2925);
+    axis.setLocationRange(0, 12000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+
+    /* The stop is at 10500 in axis counts */
+    axis.moveLocation(11500);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+
+    CHECK(dcaxis.getFault() == AXISALLY_FAULT_STALL, "fault %d, not a stall",
+          dcaxis.getFault());
+    CHECK(dc.position == 10000, "motor at %f, not the stop", dc.position);
+    /* Hits the stop at ~5.4s. The 250ms window it hits in may have
+     * moved enough to pass, but the next one can't
+     */
+    CHECK(ticks < 540 + 50, "stall took %d ticks to notice", ticks);
+    CHECK(dc.dir == RELEASE, "motor not released");
+
+    /* Holds where it stopped once cleared */
+    dcaxis.clearFault();
+    dc_run(10000);
+    CHECK(!axis.update(10), "still moving after clearFault()");
+
+    /* A following error limit catches it sooner */
+    dcaxis.setFollowingMax(200);
+    axis.moveLocation(2000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    CHECK(axis.getLocation() == 2000, "move back ended at %d",
+          axis.getLocation());
+
+    axis.moveLocation(11500);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    CHECK(dcaxis.getFault() == AXISALLY_FAULT_FOLLOWING,
+          "fault %d, not following error", dcaxis.getFault());
+    CHECK(dc.position == 10000, "motor at %f, not the stop", dc.position);
+}
+
+/* A profile the motor can't keep up with: flat out, and far behind, but
+ * moving as fast as it can, so no stall
+ */
+static void test_dcencoder_saturated()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    AxisAlly_DCEncoder<MockMotor, MockEncoder> dcaxis(&motor, &encoder);
+    AxisAlly &axis = dcaxis;
+    float fastest = 0;
+    int ticks;
+
+    dcaxis.setHoming(150, 0);
+    dcaxis.setFullSpeed(2925);
+    dcaxis.setGains(0.05, 0);
+    axis.setLocationRange(0, 9000);
+    axis.setVelocityMax(8000);
+    axis.setAccelerationMax(40000);
+    axis.begin();
+
+    axis.moveLocation(9000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+        if (dc.velocity > fastest)
+            fastest = dc.velocity;
+    }
+
+    CHECK(fastest > 2800, "only reached %f counts/s", fastest);
+    CHECK(dcaxis.getFault() == AXISALLY_FAULT_NONE,
+          "fault %d while flat out", dcaxis.getFault());
+    CHECK(abs(axis.getLocation() - 9000) <= 3, "move ended at %d",
+          axis.getLocation());
+}
+
+/* Stay inside the range, and stop at once on an endstop
+ */
+static AxisAlly_DCEncoderStatic<MockMotor, MockEncoder> *endstop_axis;
+
+static void endstop_isr()
+{
+    endstop_axis->endstop();
+}
+
+/* The switch closes just as update() writes the new PWM */
+static void endstop_close()
+{
+    dc.stop_max = dc.position;
+    endstop_isr();
+}
+
+static void test_dcencoder_limits()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    AxisAlly_DCEncoderStatic<MockMotor, MockEncoder> axis(&motor, &encoder);
+    int ticks, most;
+
+    axis.setHoming(150, 0);
+    /* Feedforward too strong for the feedback to rein in... */
+    axis.setGains(0.002, 0.0);
+    axis.setFullSpeed(1000);
+    axis.setLocationRange(0, 3000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+
+    /* ...but not past the end of the range */
+    axis.moveLocation(5000);
+    most = 0;
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+        if (axis.getLocation() > most)
+            most = axis.getLocation();
+    }
+    /* It coasts ~100 counts once the drive is cut */
+    CHECK(most <= 3000 + 150, "ran to %d, past the end of the range", most);
+    CHECK(axis.getFault() == AXISALLY_FAULT_NONE, "fault %d at the soft limit",
+          axis.getFault());
+
+    /* The endstop at 5000 counts (5500 on the axis) trips first */
+    dc.stop_max = 5000;
+    dc.isr = endstop_isr;
+    endstop_axis = &axis;
+    axis.setEndstops(-1, ENDSTOP_PIN);
+    axis.setLocationRange(0, 9000);
+    axis.moveLocation(8000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    CHECK(axis.getFault() == AXISALLY_FAULT_ENDSTOP, "fault %d, not endstop",
+          axis.getFault());
+    CHECK(dc.pwm == 0, "motor still driven at PWM %d", dc.pwm);
+    CHECK(dc.position < 5000 + 150, "coasted to %f", dc.position);
+
+    /* Can back off it, but not drive onto it again */
+    axis.clearFault();
+    axis.moveLocation(4000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    CHECK(axis.getFault() == AXISALLY_FAULT_NONE &&
+          abs(axis.getLocation() - 4000) <= 1,
+          "backing off ended at %d, fault %d", axis.getLocation(),
+          axis.getFault());
+
+    axis.moveLocation(8000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+    CHECK(axis.getFault() == AXISALLY_FAULT_ENDSTOP, "fault %d, not endstop",
+          axis.getFault());
+
+    /* The interrupt comes between update()'s check and its write */
+    dc.stop_max = 0;
+    axis.clearFault();
+    axis.moveLocation(8000);
+    for (ticks = 0; ticks < 1000 && dc.pwm == 0; ticks++) {
+        dc_run(10000);
+        axis.update(10);
+    }
+    dc.interrupt = endstop_close;
+    for (ticks = 0; ticks < 1000 && dc.interrupt; ticks++) {
+        dc_run(10000);
+        axis.update(10);
+    }
+    CHECK(!dc.interrupt, "PWM never written");
+    CHECK(dc.pwm == 0, "update() undid the endstop: PWM %d", dc.pwm);
+    dc_run(10000);
+    axis.update(10);
+    CHECK(axis.getFault() == AXISALLY_FAULT_ENDSTOP, "fault %d, not endstop",
+          axis.getFault());
+
+    dc.stop_max = 0;
+    dc.isr = NULL;
+}
+
+/* Calibrate a lopsided motor, and drive it by velocity
+ */
+static void test_dcencoder_calibrate()
+{
+    MockMotor motor;
+    MockEncoder encoder;
+    MockEEPROM eeprom;
+    AxisAlly_DCEncoderStatic<MockMotor, MockEncoder> axis(&motor, &encoder);
+    AxisAlly_DCEncoderStatic<MockMotor, MockEncoder> again(&motor, &encoder);
+    AxisAlly_PWMTable table;
+    int ticks, start;
+
+    dc.drag = 0.25;
+    axis.setHoming(150, 0);
+    axis.setLocationRange(0, 9000);
+    axis.setVelocityMax(2000);
+    axis.setAccelerationMax(8000);
+    axis.begin();
+
+    axis.moveLocation(5000);
+    for (ticks = 0; ticks < 1000; ticks++) {
+        dc_run(10000);
+        if (!axis.update(10))
+            break;
+    }
+
+    start = axis.getLocation();
+    CHECK(axis.calibrate(), "calibration failed");
+    CHECK(abs(axis.getLocation() - start) < 500, "calibration wandered from "
+          "%d to %d", start, axis.getLocation());
+
+    /* Speeds are (pwm - 60) * 15 forward, 3/4 of that backward */
+    memset(eeprom.bytes, 0xff, sizeof(eeprom.bytes));
+    CHECK(AxisAlly_PWMTable::size() <= (int)sizeof(eeprom.bytes),
+          "table is %d bytes", AxisAlly_PWMTable::size());
+    CHECK(!table.load(eeprom, 0), "loaded a blank EEPROM");
+    axis.saveCalibration(eeprom, 0);
+    CHECK(table.load(eeprom, 0), "saved table doesn't load");
+
+    CHECK(fabsf(table.getFullSpeed(1) - 2925) < 30, "forward full speed %f",
+          table.getFullSpeed(1));
+    CHECK(fabsf(table.getFullSpeed(-1) - 2194) < 30, "backward full speed %f",
+          table.getFullSpeed(-1));
+    for (int v = 200; v <= 2000; v += 300) {
+        int forward = 60 + v / 15.0;
+        int backward = 60 + v / 15.0 / 0.75;
+
+        CHECK(abs(table.pwm(v) - forward) <= 2, "%d/s forward at PWM %d, "
+              "not %d", v, table.pwm(v), forward);
+        CHECK(abs(table.pwm(-v) - backward) <= 2, "%d/s backward at PWM %d, "
+              "not %d", v, table.pwm(-v), backward);
+    }
+    CHECK(table.pwm(1) >= 55 && table.pwm(1) <= 61, "deadband edge at %d",
+          table.pwm(1));
+
+    /* A corrupt table is turned down */
+    eeprom.bytes[5] ^= 1;
+    CHECK(!again.loadCalibration(eeprom, 0), "loaded a corrupt table");
+    eeprom.bytes[5] ^= 1;
+    CHECK(again.loadCalibration(eeprom, 0), "saved table doesn't load");
+
+    /* Moves both ways track as well as the tuned linear mapping */
+    again.setLocation(axis.getLocation());
+    again.setLocationRange(0, 9000);
+    again.setVelocityMax(2000);
+    again.setAccelerationMax(8000);
+    again.setDeadband(3);
+    for (int target = 1000; target <= 8000; target += 7000) {
+        int dir = target < again.getLocation() ? -1 : 1;
+        int overshoot = 0;
+
+        again.moveLocation(target);
+        for (ticks = 0; ticks < 1000; ticks++) {
+            dc_run(10000);
+            if (!again.update(10))
+                break;
+            if (dir * (again.getLocation() - target) > overshoot)
+                overshoot = dir * (again.getLocation() - target);
+        }
+        CHECK(abs(again.getLocation() - target) <= 3, "move to %d ended at %d",
+              target, again.getLocation());
+        CHECK(overshoot < 50, "move to %d overshot by %d", target, overshoot);
+    }
+
+    dc.drag = 0.0;
+}
+
+/* Motor shield v2 writes go out together, and only when changed
+ */
+static void test_motorshield2()
+{
+    MockWire wire;
+    AxisAlly_MotorShield2<MockWire> shield(&wire);
+    AxisAlly_MotorShield2DC<MockWire> *m1 = shield.getMotor(1);
+
+    memset(&wire, 0xff, sizeof(wire));
+    wire.transfers = 0;
+    wire.longest = 0;
+    shield.begin();
+    CHECK(wire.regs[0xfe] == 3, "prescale %d", wire.regs[0xfe]);
+    CHECK(wire.regs[0x00] == 0xa0, "mode1 0x%02x", wire.regs[0x00]);
+    for (int channel = 2; channel <= 13; channel++)
+        CHECK(wire.on(channel) == 0 && wire.off(channel) == 0,
+              "channel %d not released", channel);
+    CHECK(wire.longest <= 32, "%d byte transfer", wire.longest);
+
+    /* Held: one burst per flush() */
+    wire.transfers = 0;
+    shield.hold();
+    m1->setSpeed(100);
+    m1->run(FORWARD);
+    CHECK(wire.transfers == 0, "sent while held");
+    shield.flush();
+    CHECK(wire.transfers == 1, "%d transfers for one motor", wire.transfers);
+    CHECK(wire.off(8) == 1600, "M1 PWM %d", wire.off(8));
+    CHECK(wire.on(10) == 4096 && wire.off(9) == 0 && wire.on(9) == 0,
+          "M1 not forward");
+
+    /* Unchanged, nothing to send */
+    wire.transfers = 0;
+    shield.hold();
+    m1->setSpeed(100);
+    m1->run(FORWARD);
+    shield.flush();
+    CHECK(wire.transfers == 0, "%d transfers for no change", wire.transfers);
+
+    /* All four at once still fit in two */
+    shield.hold();
+    for (int n = 1; n <= 4; n++) {
+        shield.getMotor(n)->setSpeed(10 * n);
+        shield.getMotor(n)->run(BACKWARD);
+    }
+    shield.flush();
+    CHECK(wire.transfers == 2, "%d transfers for four motors", wire.transfers);
+    CHECK(wire.longest <= 32, "%d byte transfer", wire.longest);
+    CHECK(wire.off(8) == 160 && wire.off(13) == 320 && wire.off(2) == 480 &&
+          wire.off(7) == 640, "PWM %d %d %d %d", wire.off(8), wire.off(13),
+          wire.off(2), wire.off(7));
+    CHECK(wire.on(9) == 4096 && wire.on(12) == 4096 && wire.on(3) == 4096 &&
+          wire.on(6) == 4096, "IN2 not all on");
+    CHECK(wire.on(10) == 0 && wire.on(11) == 0 && wire.on(4) == 0 &&
+          wire.on(5) == 0, "IN1 not all off");
+
+    /* Not held: straight out */
+    wire.transfers = 0;
+    m1->run(RELEASE);
+    CHECK(wire.transfers == 1 && wire.on(9) == 0 && wire.on(10) == 0,
+          "M1 not released");
+}
+
+/* The TWI, as the queue sees it: each call sets what the status will
+ * be when the interrupt comes, and twi_step() delivers it. Devices at
+ * 0x20 and 0x60 ack everything, and read back 0x10, 0x11, ...; every
+ * addressing is logged, with the bytes written after it.
+ */
+struct MockTWI {
+    static unsigned char state;
+    static bool irq, owned, addressing;
+    static unsigned char next_read;
+    static std::vector<std::vector<int> > log;
+
+    static void begin(unsigned long hz) { }
+    static unsigned char status() { return state; }
+    static void start() {
+        state = owned ? AXISALLY_TWI_REP_START : AXISALLY_TWI_START;
+        owned = addressing = irq = true;
+    }
+    static void stop() { owned = irq = false; }
+    static void send(unsigned char data) {
+        if (addressing) {
+            bool there = (data >> 1) == 0x20 || (data >> 1) == 0x60;
+
+            log.push_back(std::vector<int>(1, data));
+            if (data & 1) {
+                state = there ? AXISALLY_TWI_SLA_R_ACK : AXISALLY_TWI_SLA_R_NACK;
+                next_read = 0x10;
+            } else {
+                state = there ? AXISALLY_TWI_SLA_W_ACK : AXISALLY_TWI_SLA_W_NACK;
+            }
+            addressing = false;
+        } else {
+            log.back().push_back(data);
+            state = AXISALLY_TWI_DATA_ACK;
+        }
+        irq = true;
+    }
+    static void receive(bool ack) {
+        state = ack ? AXISALLY_TWI_RECV_ACK : AXISALLY_TWI_RECV_NACK;
+        irq = true;
+    }
+    static unsigned char data() { return next_read++; }
+    static void poll();
+};
+
+unsigned char MockTWI::state;
+bool MockTWI::irq, MockTWI::owned, MockTWI::addressing;
+unsigned char MockTWI::next_read;
+std::vector<std::vector<int> > MockTWI::log;
+
+static AxisAlly_TWIQueue<MockTWI> *twi_queue;
+
+/* One interrupt; false if none was due */
+static bool twi_step()
+{
+    if (!MockTWI::irq)
+        return false;
+    MockTWI::irq = false;
+    twi_queue->interrupt();
+    return true;
+}
+
+void MockTWI::poll()
+{
+    twi_step();
+}
+
+static int twi_done;
+
+static void twi_count(AxisAlly_TWITransfer *t)
+{
+    twi_done++;
+}
+
+/* Transfers go out in priority order, without blocking the caller
+ */
+static void test_twi_queue()
+{
+    AxisAlly_TWIQueue<MockTWI> twi;
+    AxisAlly_TWITransfer lcd[3], motor, probe, reg;
+    unsigned char bytes[4] = { 1, 2, 3, 4 };
+    unsigned char pointer = 0x06;
+    unsigned char got[3];
+
+    twi_queue = &twi;
+    twi.begin();
+
+    /* A read after a register write, with a callback */
+    memset(&reg, 0, sizeof(reg));
+    reg.address = 0x60;
+    reg.write = &pointer;
+    reg.write_len = 1;
+    reg.read = got;
+    reg.read_len = 3;
+    reg.done = twi_count;
+    CHECK(twi.submit(&reg), "submit failed");
+    CHECK(!twi.submit(&reg), "submitted twice");
+    CHECK(reg.status == AXISALLY_TWI_PENDING, "not pending");
+    while (twi_step())
+        ;
+    CHECK(reg.status == AXISALLY_TWI_DONE, "read status %d", reg.status);
+    CHECK(twi_done == 1, "callback ran %d times", twi_done);
+    CHECK(got[0] == 0x10 && got[1] == 0x11 && got[2] == 0x12,
+          "read %02x %02x %02x", got[0], got[1], got[2]);
+    CHECK(MockTWI::log.size() == 2 && MockTWI::log[0].size() == 2 &&
+          MockTWI::log[0][0] == 0xc0 && MockTWI::log[0][1] == 0x06 &&
+          MockTWI::log[1][0] == 0xc1, "read went out wrong");
+    CHECK(!MockTWI::owned && !twi.busy(), "bus not let go");
+
+    /* Nobody at 0x21; the queue carries on regardless */
+    MockTWI::log.clear();
+    memset(&probe, 0, sizeof(probe));
+    probe.address = 0x21;
+    twi.submit(&probe);
+    twi.beginTransmission(0x20);
+    twi.write(0x55);
+    CHECK(twi.endTransmission() == 0, "write not queued");
+    while (twi_step())
+        ;
+    CHECK(probe.status == AXISALLY_TWI_NACK, "probe status %d", probe.status);
+    CHECK(MockTWI::log.size() == 2 && MockTWI::log[1][0] == 0x40 &&
+          MockTWI::log[1][1] == 0x55, "write after a NACK went out wrong");
+
+    /* Motor commands overtake queued LCD updates */
+    MockTWI::log.clear();
+    for (int i = 0; i < 3; i++) {
+        memset(&lcd[i], 0, sizeof(lcd[i]));
+        lcd[i].address = 0x20;
+        lcd[i].priority = 2;
+        lcd[i].write = bytes;
+        lcd[i].write_len = 4;
+        twi.submit(&lcd[i]);
+    }
+    for (int i = 0; i < 3; i++)
+        twi_step();
+    memset(&motor, 0, sizeof(motor));
+    motor.address = 0x60;
+    motor.priority = 0;
+    motor.write = bytes;
+    motor.write_len = 1;
+    twi.submit(&motor);
+    while (twi_step())
+        ;
+    CHECK(MockTWI::log.size() == 4 && MockTWI::log[0][0] == 0x40 &&
+          MockTWI::log[0].size() == 5 && MockTWI::log[1][0] == 0xc0 &&
+          MockTWI::log[2][0] == 0x40 && MockTWI::log[3][0] == 0x40,
+          "motor write didn't go next");
+
+    /* As the motor shield's bus: flush() doesn't wait for the bus */
+    AxisAlly_MotorShield2<AxisAlly_TWIQueue<MockTWI> > shield(&twi);
+
+    twi.setPriority(0);
+    shield.begin();
+    while (twi_step())
+        ;
+    MockTWI::log.clear();
+    shield.hold();
+    shield.getMotor(1)->setSpeed(100);
+    shield.getMotor(1)->run(FORWARD);
+    shield.flush();
+    CHECK(twi.busy() && MockTWI::log.empty(), "flush() waited for the bus");
+    while (twi_step())
+        ;
+    CHECK(MockTWI::log.size() == 1 && MockTWI::log[0].size() == 14 &&
+          MockTWI::log[0][1] == 0x06 + 4 * 8, "shield burst went out wrong");
+}
+
+/* A 20x4 HD44780 behind a PCF8574 wired as in i2c-lcd: D4..D7 on bits
+ * 0..3, EN 4, RW 5, RS 6, backlight 7 (on when low)
+ */
+struct MockLCD {
+    int pins;               /* PCF8574 outputs */
+    bool nibbles;           /* In 4-bit mode */
+    int high;               /* First nibble, or -1 */
+    int address;            /* DDRAM address counter */
+    char ddram[128];
+    int chars;              /* Characters written */
+    int transfers;
+    int length, longest;
+
+    void beginTransmission(int addr) { length = 0; }
+    void write(int value) {
+        /* Latched on EN going low */
+        if ((pins & 0x10) && !(value & 0x10))
+            strobe(pins & 0xf, pins & 0x40);
+        pins = value;
+        length++;
+    }
+    int endTransmission() {
+        transfers++;
+        if (length > longest)
+            longest = length;
+        return 0;
+    }
+
+    void strobe(int nibble, bool rs) {
+        if (!nibbles) {
+            /* 8-bit mode: only the top four lines are wired */
+            if (nibble == 0x2)
+                nibbles = true;
+            return;
+        }
+        if (high < 0) {
+            high = nibble;
+            return;
+        }
+        byte(high << 4 | nibble, rs);
+        high = -1;
+    }
+
+    void byte(int value, bool rs) {
+        if (rs) {
+            ddram[address++ & 0x7f] = value;
+            chars++;
+        } else if (value & 0x80) {
+            address = value & 0x7f;
+        } else if (value == 0x01) {
+            memset(ddram, ' ', sizeof(ddram));
+            address = 0;
+        }
+    }
+
+    /* What row r shows */
+    std::string row(int r) {
+        static const int start[4] = { 0x00, 0x40, 0x14, 0x54 };
+        return std::string(ddram + start[r], 20);
+    }
+};
+
+/* Only what changed goes out, a few cells at a time
+ */
+static void test_lcd()
+{
+    MockLCD bus;
+    AxisAlly_LCD<MockLCD> lcd(&bus, 0x20, 4, 5, 6, 0, 7, true);
+    int updates;
+
+    memset(&bus, 0, sizeof(bus));
+    memset(bus.ddram, '#', sizeof(bus.ddram));
+    bus.high = -1;
+    lcd.begin();
+    CHECK(bus.nibbles, "not in 4-bit mode");
+    CHECK(bus.row(0) == std::string(20, ' '), "not cleared");
+    CHECK(!(bus.pins & 0x80), "backlight off");
+
+    lcd.setCursor(0, 0);
+    lcd.print("X");
+    lcd.print(-1234, 8);
+    lcd.setCursor(0, 3);
+    lcd.print("Done");
+    lcd.print(100L, 4);
+    lcd.print("%");
+    bus.chars = 0;
+    bus.longest = 0;
+    for (updates = 0; lcd.update(); updates++)
+        ;
+    CHECK(bus.row(0) == "X   -1234           ", "row 0 is '%s'",
+          bus.row(0).c_str());
+    CHECK(bus.row(3) == "Done 100%           ", "row 3 is '%s'",
+          bus.row(3).c_str());
+    CHECK(bus.chars == 14, "%d characters for 14 cells", bus.chars);
+    CHECK(bus.longest <= 16, "%d bytes in one update", bus.longest);
+
+    /* One digit changes: one cursor move and one character */
+    lcd.setCursor(1, 0);
+    lcd.print(-1235, 8);
+    bus.chars = 0;
+    bus.transfers = 0;
+    CHECK(!lcd.update(), "more to send for one digit");
+    CHECK(bus.chars == 1 && bus.transfers == 1 && bus.longest <= 16,
+          "%d characters in %d transfers", bus.chars, bus.transfers);
+    CHECK(bus.row(0) == "X   -1235           ", "row 0 is '%s'",
+          bus.row(0).c_str());
+
+    /* Nothing changed, nothing sent */
+    bus.transfers = 0;
+    CHECK(!lcd.update() && bus.transfers == 0, "sent with no changes");
+
+    /* A budget of one still gets there, a character at a time, though
+     * every row needs a cursor move first
+     */
+    lcd.setBudget(1);
+    lcd.setCursor(0, 1);
+    lcd.print("ab");
+    lcd.setCursor(0, 2);
+    lcd.print("c");
+    bus.chars = 0;
+    for (updates = 1; lcd.update() && updates < 10; updates++)
+        ;
+    CHECK(updates == 3 && bus.chars == 3, "%d characters in %d updates",
+          bus.chars, updates);
+    CHECK(bus.row(1) == "ab                  " &&
+          bus.row(2) == "c                   ", "rows 1 and 2 are '%s' '%s'",
+          bus.row(1).c_str(), bus.row(2).c_str());
+
+    /* A budget of three: a cursor move and two characters */
+    lcd.setBudget(3);
+    lcd.setCursor(0, 1);
+    lcd.print("wxyz");
+    bus.chars = 0;
+    CHECK(lcd.update() && bus.chars == 2, "%d characters in the first update",
+          bus.chars);
+    CHECK(!lcd.update() && bus.row(1) == "wxyz                ",
+          "row 1 is '%s'", bus.row(1).c_str());
+}
+
+/* The scheduler's clock, which only the tasks (and idling) move on
+ */
+static unsigned long sched_us;
+static std::string sched_order;
+static unsigned long sched_slow;        /* One-off extra telemetry time */
+
+struct MockClock {
+    static unsigned long now() { return sched_us; }
+};
+
+struct MockOut {
+    std::string text;
+
+    void print(const char *s) { text += s; }
+    void print(unsigned long value) { text += std::to_string(value); }
+    void print(long value) { text += std::to_string(value); }
+    void print(double value, int digits) {
+        char s[32];
+
+        snprintf(s, sizeof(s), "%.*f", digits, value);
+        text += s;
+    }
+};
+
+static void task_control() { sched_us += 200; sched_order += 'c'; }
+static void task_serial() { sched_us += 50; sched_order += 's'; }
+static void task_telemetry()
+{
+    sched_us += 300 + sched_slow;
+    sched_slow = 0;
+    sched_order += 't';
+}
+
+static void sched_until(AxisAlly_Scheduler<MockClock> *sched,
+                        unsigned long until)
+{
+    while (sched_us < until) {
+        if (!sched->run())
+            sched_us += 10;
+    }
+}
+
+/* Periodic tasks keep their rate, nearest deadline first, and the
+ * background task fills the gaps; an overrun shows in the report
+ */
+static void test_scheduler()
+{
+    AxisAlly_Scheduler<MockClock> sched;
+    MockOut out;
+
+    sched_us = 1000;
+    sched_order = "";
+    sched_slow = 0;
+    CHECK(sched.add("telemetry", task_telemetry, 10000) == 0, "no room");
+    CHECK(sched.add("control", task_control, 1000) == 1, "no room");
+    CHECK(sched.add("serial", task_serial, 0) == 2, "no room");
+    CHECK(sched.run() && sched_order == "c", "'%s' ran first",
+          sched_order.c_str());
+
+    sched_until(&sched, 101000);
+    const AxisAlly_TaskStats &control = sched.stats(1);
+    const AxisAlly_TaskStats &telemetry = sched.stats(0);
+    CHECK(control.runs == 100, "control ran %lu times", control.runs);
+    CHECK(telemetry.runs == 10, "telemetry ran %lu times", telemetry.runs);
+    CHECK(sched.stats(2).runs > 1000, "serial ran %lu times",
+          sched.stats(2).runs);
+    CHECK(control.worst_us == 200 && telemetry.worst_us == 300,
+          "worst %lu, %lu", control.worst_us, telemetry.worst_us);
+    CHECK(control.late_us <= 300, "control %luus late", control.late_us);
+    CHECK(!control.overruns && !telemetry.overruns && !control.skipped,
+          "overran");
+
+    /* Telemetry blocks for 2.5ms: control's next run misses its
+     * deadline, and of the two releases it slept through, the one
+     * already past its own next release is dropped, not caught up
+     */
+    sched.resetStats();
+    sched_slow = 2500;
+    sched_until(&sched, 121000);
+    CHECK(control.overruns == 1, "control overran %lu times",
+          control.overruns);
+    CHECK(control.skipped == 1, "control skipped %lu", control.skipped);
+    CHECK(control.runs == 19, "control ran %lu times", control.runs);
+    CHECK(telemetry.worst_us == 2800, "worst %lu", telemetry.worst_us);
+
+    sched.report(out);
+    CHECK(out.text.find("\ncontrol 19 200 2000 1 1\r\n") != std::string::npos,
+          "report:\n%s", out.text.c_str());
+
+    /* Disabled, nothing runs but the background */
+    sched.enable(0, false);
+    sched.enable(1, false);
+    sched.resetStats();
+    sched_until(&sched, 131000);
+    CHECK(!control.runs && !telemetry.runs, "disabled tasks ran");
+}
+
+static AxisAlly_ProfileSection *profile_find(const char *name)
+{
+    AxisAlly_ProfileSection *s;
+
+    for (s = AxisAlly_ProfileSection::first(); s; s = s->next()) {
+        if (!strcmp(s->name(), name))
+            return s;
+    }
+    return 0;
+}
+
+static void profiled_work(int us)
+{
+    AXISALLY_PROFILE_SCOPE(work);
+
+    delayMicroseconds(us);
+}
+
+/* Sections time what they wrap, and the DC motor axis has its own
+ */
+static void test_profile()
+{
+    AxisAlly_ProfileSection *work;
+    MockOut out;
+
+    AXISALLY_PROFILE_SETUP();
+    CHECK(profile_find("control") && profile_find("control")->count(),
+          "control not profiled");
+    CHECK(profile_find("encoder_read") && profile_find("motor_write"),
+          "encoder or motor not profiled");
+
+    AXISALLY_PROFILE_RESET();
+    CHECK(!profile_find("control")->count(), "not reset");
+    for (int i = 0; i < 3; i++)
+        profiled_work(300);
+    profiled_work(100);
+
+    AXISALLY_PROFILE_ENTER(pause);
+    delay(5);
+    AXISALLY_PROFILE_EXIT(pause);
+
+    work = profile_find("work");
+    CHECK(work && work->count() == 4, "work ran %lu times",
+          work ? work->count() : 0);
+    CHECK(work->shortest() == 100 && work->average() == 250 &&
+          work->longest() == 300, "work %lu/%lu/%lu",
+          work->shortest(), work->average(), work->longest());
+    /* 300 in 256..511, 100 in 64..127 */
+    CHECK(work->bucket(8) == 3 && work->bucket(6) == 1, "histogram");
+    CHECK(profile_find("pause")->longest() == 5000, "pause %lu",
+          profile_find("pause")->longest());
+
+    AXISALLY_PROFILE_DUMP(out);
+    CHECK(out.text.find("profile ticks/us 1\r\n") == 0 &&
+          out.text.find("\nwork 4 100 250 300: 0 0 0 0 0 0 1 0 3 0 ") !=
+          std::string::npos, "dump:\n%s", out.text.c_str());
+}
+
+/* Pins for count & 3, counting up */
+static const unsigned char quad_gray[4] = { 0, 2, 3, 1 };
+
+/* Short glitches are dropped, edges that hold count, and edges faster
+ * than the filter are lost
+ */
+static void test_quad_decoder()
+{
+    AxisAlly_QuadDecoder plain, filtered;
+    unsigned long us = 0;
+    int i;
+
+    filtered.setFilter(5);
+
+    /* 40 counts up, a sample a microsecond, an edge every 10us, with a
+     * 1us glitch on the other pin halfway between each
+     */
+    for (i = 1; i <= 40; i++) {
+        for (int k = 0; k < 10; k++, us++) {
+            unsigned char pins = quad_gray[i & 3];
+
+            if (k == 5)
+                pins ^= (pins ^ quad_gray[(i - 1) & 3]) ^ 3;
+            plain.sample(pins, us);
+            filtered.sample(pins, us);
+        }
+    }
+    CHECK(plain.count() == 40, "plain counted %ld", plain.count());
+    CHECK(filtered.count() == 40, "filtered counted %ld", filtered.count());
+    CHECK(filtered.glitches() == 40, "%lu glitches", filtered.glitches());
+
+    /* A glitch the unfiltered decoder takes as +1 then -1, the filtered
+     * one not at all
+     */
+    long peak = plain.count();
+    bool moved = false;
+    for (int k = 0; k < 4; k++, us++) {
+        unsigned char pins = quad_gray[0] ^ (k == 1 ? 2 : 0);
+
+        plain.sample(pins, us);
+        filtered.sample(pins, us);
+        if (plain.count() > peak)
+            peak = plain.count();
+        moved |= filtered.count() != 40;
+    }
+    CHECK(peak == 41 && plain.count() == 40, "plain peaked at %ld",
+          peak);
+    CHECK(!moved, "filtered counted a glitch");
+
+    /* One edge, then nothing until read: it counts once it has held */
+    filtered.sample(quad_gray[1], us);
+    filtered.sample(quad_gray[1], us + 4);
+    CHECK(filtered.count() == 40, "counted before the dwell");
+    filtered.sample(quad_gray[1], us + 5);
+    CHECK(filtered.count() == 41, "not counted after the dwell");
+    us += 5;
+
+    /* Edges every 2us are too fast for a 5us dwell */
+    filtered.setCount(0);
+    for (i = 2; i < 42; i++) {
+        us += 2;
+        filtered.sample(quad_gray[i & 3], us);
+    }
+    filtered.sample(quad_gray[41 & 3], us + 10);
+    CHECK(filtered.count() < 10, "tracked %ld of 40 fast edges",
+          filtered.count());
+
+    /* Polled every 50us: a glitch caught by one poll is gone by the
+     * next, which only the polled filter can tell from an edge
+     */
+    AxisAlly_QuadDecoder polled;
+    polled.setFilter(5, true);
+    filtered.setCount(0);
+    filtered.begin(quad_gray[0]);
+    polled.begin(quad_gray[0]);
+    us += 50;
+    filtered.sample(quad_gray[1], us);
+    polled.sample(quad_gray[1], us);
+    us += 50;
+    filtered.sample(quad_gray[0], us);
+    polled.sample(quad_gray[0], us);
+    CHECK(filtered.count() == 1, "glitch counted %ld", filtered.count());
+    CHECK(polled.count() == 0 && polled.glitches() == 1,
+          "polled counted %ld, %lu glitches", polled.count(),
+          polled.glitches());
+
+    /* Seen twice, an edge counts, from when it was first seen */
+    for (i = 1; i <= 4; i++) {
+        us += 50;
+        polled.sample(quad_gray[i & 3], us);
+        polled.sample(quad_gray[i & 3], us + 25);
+    }
+    CHECK(polled.count() == 4, "polled tracked %ld of 4 edges",
+          polled.count());
+}
+
+/* Step a decoder n counts, one edge at a time, calling index() where
+ * the count passes a multiple of 100 (plus 30) going up
+ */
+static void quad_move(AxisAlly_QuadDecoder *dec, long *position, int n)
+{
+    int dir = n < 0 ? -1 : 1;
+
+    for (; n; n -= dir) {
+        *position += dir;
+        dec->sample(quad_gray[*position & 3], 0);
+        if (dir > 0 && *position % 100 == 30)
+            dec->index();
+    }
+}
+
+/* The index sets the origin, and a count lost in between only lasts
+ * until the next one
+ */
+static void test_quad_index()
+{
+    AxisAlly_QuadDecoder dec;
+    long position = 0;
+
+    dec.setRevolution(100);
+    quad_move(&dec, &position, 20);
+    CHECK(!dec.indexed() && dec.angle() == 20, "angle %ld before index",
+          dec.angle());
+
+    quad_move(&dec, &position, 15);
+    CHECK(dec.indexed() && dec.angle() == 5 && dec.revolutions() == 0,
+          "angle %ld turn %ld after index", dec.angle(), dec.revolutions());
+
+    quad_move(&dec, &position, 200);
+    CHECK(dec.angle() == 5 && dec.revolutions() == 2 && dec.drift() == 0,
+          "angle %ld turn %ld drift %ld", dec.angle(), dec.revolutions(),
+          dec.drift());
+
+    /* Back through the index: turn -1, near the end of it */
+    quad_move(&dec, &position, -250);
+    CHECK(dec.angle() == 55 && dec.revolutions() == -1,
+          "angle %ld turn %ld going back", dec.angle(), dec.revolutions());
+
+    /* Lose 3 counts: wrong until the next index puts it right */
+    dec.setCount(dec.count() - 3);
+    quad_move(&dec, &position, 40);
+    CHECK(dec.angle() == 92, "angle %ld after losing 3", dec.angle());
+    quad_move(&dec, &position, 20);
+    CHECK(dec.angle() == 15 && dec.revolutions() == 0 && dec.drift() == -3,
+          "angle %ld turn %ld drift %ld", dec.angle(), dec.revolutions(),
+          dec.drift());
+}
+
+/* Between edges at a steady speed the position moves on smoothly; an
+ * edge crossed back and forth reads as the edge
+ */
+static void test_quad_interpolate()
+{
+    AxisAlly_QuadDecoder dec;
+    unsigned long us;
+    long i;
+
+    CHECK(dec.position(0) == 0.0 && dec.velocity(0) == 0.0,
+          "position %f before any edge", dec.position(0));
+
+    /* 10 counts up, 100us apart */
+    for (i = 1, us = 100; i <= 10; i++, us += 100)
+        dec.sample(quad_gray[i & 3], us);
+    us -= 100;
+    CHECK(fabs(dec.position(us) - 9.5) < 0.001, "position %f at the edge",
+          dec.position(us));
+    CHECK(fabs(dec.position(us + 25) - 9.75) < 0.001,
+          "position %f a quarter on", dec.position(us + 25));
+    CHECK(fabs(dec.position(us + 500) - 10.5) < 0.001,
+          "position %f long after", dec.position(us + 500));
+    CHECK(fabs(dec.velocity(us + 50) - 10000.0) < 0.1, "velocity %f",
+          dec.velocity(us + 50));
+    CHECK(fabs(dec.velocity(us + 400) - 2500.0) < 0.1,
+          "velocity %f slowing", dec.velocity(us + 400));
+
+    /* Dithering over the edge between 9 and 10 */
+    for (int k = 0; k < 4; k++) {
+        us += 100;
+        dec.sample(quad_gray[(k & 1 ? 10 : 9) & 3], us);
+        CHECK(fabs(dec.position(us + 50) - 9.5) < 0.001,
+              "position %f dithering", dec.position(us + 50));
+        CHECK(dec.velocity(us + 50) == 0.0, "velocity %f dithering",
+              dec.velocity(us + 50));
+    }
+
+    /* Going down, it leads the count the other way */
+    for (i = 9; i >= 5; i--) {
+        us += 100;
+        dec.sample(quad_gray[i & 3], us);
+    }
+    CHECK(dec.count() == 5 && fabs(dec.position(us + 50) - 5.0) < 0.001,
+          "count %ld position %f going down", dec.count(),
+          dec.position(us + 50));
+
+    /* A count written by hand has nothing to go on */
+    dec.setCount(100);
+    CHECK(dec.position(us + 50) == 100.0, "position %f after setCount",
+          dec.position(us + 50));
+}
+
+/* Settings survive a reset, and saving spreads over the slots
+ */
+struct ConfigTest {
+    int pwm_min;
+    long max_pos;
+    float kp;
+};
+
+static const ConfigTest config_defaults = { 98, 4250, 0.04066 };
+
+static const AxisAlly_ConfigField config_fields[] = {
+    AXISALLY_CONFIG_FIELD(ConfigTest, pwm_min),
+    AXISALLY_CONFIG_FIELD(ConfigTest, max_pos),
+    AXISALLY_CONFIG_FIELD(ConfigTest, kp),
+};
+
+typedef AxisAlly_ConfigStore<ConfigTest, MockEEPROM> ConfigStore;
+
+static void test_config()
+{
+    MockEEPROM eeprom;
+    ConfigStore config(&eeprom, 16, 4, 1, config_defaults, config_fields, 3);
+    MockOut out;
+    unsigned long most;
+
+    memset(eeprom.bytes, 0xff, sizeof(eeprom.bytes));
+    memset(eeprom.wear, 0, sizeof(eeprom.wear));
+    CHECK(16 + ConfigStore::size(4) <= (int)sizeof(eeprom.bytes),
+          "store is %d bytes", ConfigStore::size(4));
+
+    CHECK(!config.load(), "loaded a blank EEPROM");
+    CHECK(config.get().kp == config_defaults.kp, "kp %f, not the default",
+          config.get().kp);
+
+    CHECK(config.command("get", out), "get failed");
+    CHECK(out.text == "pwm_min 98\r\nmax_pos 4250\r\nkp 0.04066\r\n",
+          "get gave \"%s\"", out.text.c_str());
+    out.text = "";
+    CHECK(config.command("set kp 0.05", out) && config.get().kp == 0.05f,
+          "set kp gave %f", config.get().kp);
+    CHECK(config.command(" set  max_pos -300", out) &&
+          config.get().max_pos == -300, "set max_pos gave %ld",
+          config.get().max_pos);
+    CHECK(out.text == "kp 0.05000\r\nmax_pos -300\r\n", "set answered "
+          "\"%s\"", out.text.c_str());
+    CHECK(!config.command("set pwm_min 9x", out) &&
+          config.get().pwm_min == 98, "took a bad number");
+    /* Too big for the field, rather than cut down to fit */
+    CHECK(!config.command("set pwm_min 99999999999", out) &&
+          config.get().pwm_min == 98, "took an int out of range");
+    CHECK(!config.command("set max_pos 99999999999999999999", out) &&
+          config.get().max_pos == -300, "took a long out of range");
+    CHECK(!config.command("set kd 1", out), "took an unknown field");
+    CHECK(!config.command("frob", out), "took an unknown command");
+
+    /* Not in EEPROM until saved */
+    {
+        ConfigStore again(&eeprom, 16, 4, 1, config_defaults, config_fields, 3);
+
+        CHECK(!again.load(), "loaded before saving");
+        config.command("save", out);
+        CHECK(again.load() && again.get().kp == 0.05f &&
+              again.get().max_pos == -300, "saved config doesn't load");
+    }
+
+    /* Wear spreads over the slots; unchanged bytes aren't rewritten */
+    for (int i = 0; i < 39; i++) {
+        config.get().pwm_min = 100 + i;
+        config.save();
+    }
+    most = 0;
+    for (int i = 0; i < (int)sizeof(eeprom.wear) / (int)sizeof(eeprom.wear[0]); i++)
+        if (eeprom.wear[i] > most)
+            most = eeprom.wear[i];
+    CHECK(most <= 10, "a byte was written %lu times in 40 saves", most);
+    CHECK(eeprom.wear[16 + 3 + offsetof(ConfigTest, kp)] <= 1,
+          "unchanged kp written %lu times",
+          eeprom.wear[16 + 3 + offsetof(ConfigTest, kp)]);
+
+    /* A torn save leaves the one before */
+    {
+        ConfigStore again(&eeprom, 16, 4, 1, config_defaults, config_fields, 3);
+        int at = 16 + config.slot() * (sizeof(ConfigTest) + 5) + 4;
+
+        CHECK(again.load() && again.get().pwm_min == 138, "loaded pwm_min "
+              "%d, not the last saved", again.get().pwm_min);
+        eeprom.bytes[at] ^= 0x10;
+        CHECK(again.load() && again.get().pwm_min == 137, "loaded pwm_min "
+              "%d from a corrupt slot", again.get().pwm_min);
+        eeprom.bytes[at] ^= 0x10;
+    }
+
+    /* Another version is ignored */
+    {
+        ConfigStore other(&eeprom, 16, 4, 2, config_defaults, config_fields, 3);
+
+        CHECK(!other.load() && other.get().pwm_min == 98,
+              "loaded another version's config");
+    }
+
+    /* The sequence number wraps */
+    for (long i = 0; i < 0x10000; i++)
+        config.save();
+    config.get().pwm_min = 7;
+    config.save();
+    {
+        ConfigStore again(&eeprom, 16, 4, 1, config_defaults, config_fields, 3);
+
+        CHECK(again.load() && again.get().pwm_min == 7 &&
+              again.slot() == config.slot(), "loaded pwm_min %d from slot %d "
+              "after wrapping, not slot %d", again.get().pwm_min,
+              again.slot(), config.slot());
+    }
+
+    out.text = "";
+    config.command("defaults", out);
+    CHECK(config.get().kp == config_defaults.kp && out.text == "defaults\r\n",
+          "defaults gave kp %f", config.get().kp);
+}
+
+/* Steps follow the plan without outrunning it
+ */
+static void test_stepper_moves()
+{
+    MockStepper motor = { 0, 0 };
+    AxisAlly_Stepper<MockStepper> stepper(&motor);
+    AxisAlly &axis = stepper;
+    int ticks, worst = 0;
+
+    stepper.setStepsMax(16);
+    axis.setVelocityMax(1000);
+    axis.setAccelerationMax(4000);
+    axis.begin();
+
+    axis.moveLocation(-3000);
+    for (ticks = 0; ticks < 10000; ticks++) {
+        int steps = motor.steps;
+        bool moving = axis.update(10);
+
+        if (motor.steps - steps > worst)
+            worst = motor.steps - steps;
+        if (!moving)
+            break;
+    }
+
+    CHECK(motor.position == -3000, "stepper at %d", motor.position);
+    CHECK(axis.getLocation() == -3000, "location %d", axis.getLocation());
+    CHECK(motor.steps == 3000, "%d steps for a 3000 step move", motor.steps);
+    CHECK(worst <= 11, "%d steps in one 10ms update", worst);
+}
+
+/* Run a ramp until it comes to rest on its target, checking its
+ * speed and acceleration
+ *   Returns the seconds taken; at step 'at' (if any) the target
+ *   changes to 'retarget'. Speeds are measured over 10 steps, since
+ *   single intervals jitter by a timer tick.
+ */
+static double run_ramp(AxisAlly_StepRamp &ramp, double tick_hz,
+                       float vmax, float amax, long at, long retarget)
+{
+    const int w = 10;
+    std::vector<double> when;
+    std::vector<long> where;
+    double t = 0, worst_v = 0, worst_a = 0;
+    long steps = 0;
+
+    when.push_back(t);
+    where.push_back(ramp.getPosition());
+    while (ramp.isMoving()) {
+        long p = ramp.getPosition();
+        unsigned int ticks = ramp.tick();
+
+        if (ramp.getPosition() != p) {
+            when.push_back(t);
+            where.push_back(ramp.getPosition());
+            if (++steps == at)
+                ramp.setTarget(retarget);
+        }
+
+        /* At rest, poll every ms like the timer interrupt would */
+        t += (ticks ? ticks : tick_hz / 1000) / tick_hz;
+    }
+
+    for (size_t i = 0; i + 2 * w < when.size(); i++) {
+        double v0 = (where[i + w] - where[i]) / (when[i + w] - when[i]);
+        double v1 = (where[i + 2 * w] - where[i + w]) /
+                    (when[i + 2 * w] - when[i + w]);
+        double a = fabs(v1 - v0) / ((when[i + 2 * w] - when[i]) / 2);
+
+        /* Only within one direction; turning round rests in between */
+        if (abs(where[i + 2 * w] - where[i]) != 2 * w)
+            continue;
+        if (fabs(v1) > worst_v)
+            worst_v = fabs(v1);
+        if (a > worst_a)
+            worst_a = a;
+    }
+
+    CHECK(worst_v <= vmax * 1.001, "ramp reached %f steps/s", worst_v);
+    CHECK(worst_a <= amax * 1.02, "ramp accelerated at %f", worst_a);
+    return t;
+}
+
+static void test_step_ramp()
+{
+    AxisAlly_StepRamp ramp;
+    double t;
+    float amin;
+
+    ramp.setLimits(2000000, 1000, 4000);
+    ramp.setTarget(5000);
+    t = run_ramp(ramp, 2000000, 1000, 4000, 0, 0);
+    CHECK(ramp.getPosition() == 5000, "ramp ended at %ld", ramp.getPosition());
+    CHECK(!ramp.isMoving(), "ramp still moving");
+    /* 5s at speed, plus 1/4s lost getting up to and down from it */
+    CHECK(fabs(t - 5.25) < 0.05, "5000 steps took %fs", t);
+
+    /* Turn round mid-move */
+    ramp.setTarget(8000);
+    run_ramp(ramp, 2000000, 1000, 4000, 1000, 2000);
+    CHECK(ramp.getPosition() == 2000, "retarget ended at %ld", ramp.getPosition());
+
+    /* Too gentle a start for the timer: the ramp keeps to the least
+     * acceleration it can do, rather than starting faster than that
+     */
+    amin = AxisAlly_StepRamp::accelerationMin(2000000);
+    CHECK(amin > 800 && amin < 900, "least acceleration %f at 2MHz", amin);
+    ramp.setLimits(2000000, 1000, 100);
+    ramp.setTarget(3000);
+    t = run_ramp(ramp, 2000000, 1000, amin, 0, 0);
+    CHECK(ramp.getPosition() == 3000, "gentle ramp ended at %ld", ramp.getPosition());
+    /* From 2000: 1s at speed, plus what getting up to it and down loses */
+    CHECK(fabs(t - (1.0 + 1000 / amin)) < 0.05, "gentle ramp took %fs", t);
+}
+
+/* The motor follows the interrupt-driven ramp from update()
+ */
+static void test_stepper_timed()
+{
+    MockStepper motor = { 0, 0 };
+    AxisAlly_StepperTimed<MockStepper> stepper(&motor, 2000000);
+    AxisAlly &axis = stepper;
+    unsigned long due = 0, now = 0;
+    int last = 0, backwards = 0;
+
+    axis.setVelocityMax(1000);
+    axis.setAccelerationMax(4000);
+    axis.begin();
+    axis.moveLocation(3000);
+
+    /* 0.5us timer ticks; loop() comes round every 1ms */
+    for (now = 0; now < 10 * 2000000UL; now += 2000) {
+        while (due <= now) {
+            unsigned int ticks = stepper.tick();
+            due += ticks ? ticks : 2000;
+        }
+        if (!axis.update(1) && axis.getLocation() == 3000)
+            break;
+        if (axis.getLocation() < last)
+            backwards++;
+        last = axis.getLocation();
+    }
+
+    CHECK(motor.position == 3000, "stepper at %d", motor.position);
+    CHECK(motor.steps == 3000, "%d steps for a 3000 step move", motor.steps);
+    CHECK(now < 4 * 2000000UL, "move took %fs", now / 2000000.0);
+    CHECK(backwards == 0, "stepper went backwards %d times", backwards);
+}
 
 int main(int argc, char **argv)
 {
+    test_batch_matches_sim();
+    test_profile_random_dt();
+    test_loop_outlier();
+    test_dcencoder_moves();
+    test_dcencoder_stall();
+    test_dcencoder_saturated();
+    test_dcencoder_limits();
+    test_dcencoder_calibrate();
+    test_dcencoder_backlash();
+    test_dcencoder_adapt();
+    test_motorshield2();
+    test_twi_queue();
+    test_lcd();
+    test_scheduler();
+    test_profile();
+    test_quad_decoder();
+    test_quad_index();
+    test_quad_interpolate();
+    test_config();
+    test_stepper_moves();
+    test_step_ramp();
+    test_stepper_timed();
+
+    if (failures) {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
 
+    printf("All tests passed\n");
+    return 0;
+}
+/* vim: set shiftwidth=4 expandtab:  */
@@ -12,7 +12,7 @@
 #include <Wire.h>
 #include <Arduino.h>
 
-const char version[] = "0.1.05";
+const char version[] = "0.1.06";
 
 // scans devices from 50 to 800KHz I2C speeds.
 // lower than 50 is not possible
@@ -29,13 +29,28 @@ int addressEnd = 127;
 #define RESTORE_LATENCY  5    // for delay between tests of found devices.
 bool delayFlag = false;
 
+// BENCHMARK
+// Reads only read. Writes send a single 0, which on most register
+// based chips (the motor shield's PCA9685) only sets the register
+// pointer, but on a plain port expander it IS the output: a PCF8574
+// LCD backpack drives every pin low and turns the backlight off. So
+// writes are only benchmarked at addresses turned on with 'w'.
+#define BENCH_TRANSFERS  1000  // per device, speed and direction
+#define BENCH_READ       16    // bytes per read transfer
+#define BENCH_BUCKETS    64    // one more for everything slower
+#define BENCH_SLACK      256   // usec of Wire overhead to allow for
+uint16_t histogram[BENCH_BUCKETS + 1];
+uint16_t benchBucket;          // usec per bucket, for the bus speed
+uint32_t latencyMax;
+uint8_t benchWrite[16];        // addresses to write to, a bit each
+
 // MINIMIZE OUTPUT
 bool printAll = true;
 bool header = true;
 
 // STATE MACHINE
 enum states {
-  STOP, ONCE, CONT, HELP };
+  STOP, ONCE, CONT, BENCH, HELP };
 states state = STOP;
 
 uint32_t startScan;
@@ -61,6 +76,9 @@ void loop()
   case 'c':
     state = CONT;
     break;
+  case 'b':
+    state = BENCH;
+    break;
   case 'd':
     delayFlag = !delayFlag;
     Serial.print(F("<delay="));
@@ -94,6 +112,10 @@ void loop()
     setAddress();
     break;
 
+  case 'w':
+    setWrite();
+    break;
+
   case 'q':
   case '?':
     state = HELP;
@@ -112,6 +134,10 @@ void loop()
     I2Cscan();
     delay(1000);
     break;
+  case BENCH:
+    I2Cbenchmark();
+    state = HELP;
+    break;
   case HELP:
     displayHelp();
     state = STOP;
@@ -144,6 +170,23 @@ void setAddress()
 
 }
 
+// Turn writes on or off for the address that follows ('w96'); off
+// for all by default, since a write may change a device's outputs
+void setWrite()
+{
+  long address = Serial.parseInt();
+
+  if (address < 0 || address > 127)
+  {
+    Serial.println(F("<write address 0..127>"));
+    return;
+  }
+  benchWrite[address / 8] ^= 1 << (address % 8);
+  Serial.print(F("<write "));
+  Serial.print(address);
+  Serial.println((benchWrite[address / 8] & (1 << (address % 8))) ? F(" = on>") : F(" = off>"));
+}
+
 void setSpeed(char sp)
 {
   switch(sp)
@@ -193,6 +236,8 @@ void displayHelp()
   Serial.println(F("\ts = single scan"));
   Serial.println(F("\tc = continuous scan - 1 second delay"));
   Serial.println(F("\tq = quit continuous scan"));
+  Serial.println(F("\tb = benchmark found devices at each speed"));
+  Serial.println(F("\tw<addr> = toggle write benchmark at a (decimal) address"));
   Serial.println(F("\td = toggle latency delay between successful tests. 0 - 5 ms"));
   Serial.println(F("Output:"));
   Serial.println(F("\tp = toggle printAll - printFound."));
@@ -292,3 +337,120 @@ void I2Cscan()
 }
 
 
+// Throughput, latency and errors for every device found, at every
+// speed: BENCH_TRANSFERS one byte writes, if turned on for the address
+// with 'w', then as many BENCH_READ byte reads.
+void I2Cbenchmark()
+{
+  uint8_t count = 0;
+
+  Serial.println(F("ADDR\tKHz\tDIR\tp50\tp90\tp99\tmax[us]\tbin[us]\tKB/s\tERR"));
+  for (uint8_t s = 0; s < 10; s++)
+  {
+    Serial.print(F("--------"));
+  }
+  Serial.println();
+
+  for (uint8_t address = addressStart; address <= addressEnd; address++)
+  {
+    TWBR = (F_CPU/(100*1000L) - 16)/2;
+    Wire.beginTransmission(address);
+    if (Wire.endTransmission() != 0) continue;
+    count++;
+
+    for (uint8_t s = 0; s < speeds; s++)
+    {
+      TWBR = (F_CPU/(speed[s]*1000) - 16)/2;
+      if (benchWrite[address / 8] & (1 << (address % 8)))
+        benchmarkSpeed(address, speed[s], false);
+      benchmarkSpeed(address, speed[s], true);
+      if (delayFlag) delay(RESTORE_LATENCY);
+    }
+  }
+
+  Serial.println();
+  Serial.print(count);
+  Serial.println(F(" devices benchmarked."));
+}
+
+void benchmarkSpeed(uint8_t address, long kHz, bool read)
+{
+  uint16_t errors = 0;
+  uint32_t bytes = 0;
+  uint32_t start, elapsed;
+
+  // A transfer is 9 bits a byte (with the ACK) on the wire, plus the
+  // start and stop; the histogram covers 4 times that, so its buckets
+  // are a few percent of a transfer at any speed
+  uint32_t wire = ((read ? 1 + BENCH_READ : 2) * 9 + 2) * 1000L / kHz;
+  benchBucket = (4 * wire + BENCH_SLACK) / BENCH_BUCKETS + 1;
+
+  memset(histogram, 0, sizeof(histogram));
+  latencyMax = 0;
+
+  start = micros();
+  for (uint16_t i = 0; i < BENCH_TRANSFERS; i++)
+  {
+    uint32_t then = micros();
+    bool ok;
+
+    if (read)
+    {
+      uint8_t n = Wire.requestFrom(address, (uint8_t)BENCH_READ);
+      ok = (n == BENCH_READ);
+      while (Wire.available()) Wire.read();
+      bytes += 1 + n;  // address, then data
+    }
+    else
+    {
+      Wire.beginTransmission(address);
+      Wire.write((uint8_t)0);
+      ok = (Wire.endTransmission() == 0);
+      bytes += 2;
+    }
+    if (!ok) errors++;
+
+    uint32_t latency = micros() - then;
+    uint32_t bucket = latency / benchBucket;
+    histogram[bucket < BENCH_BUCKETS ? bucket : BENCH_BUCKETS]++;
+    if (latency > latencyMax) latencyMax = latency;
+  }
+  elapsed = micros() - start;
+
+  Serial.print(F("0x"));
+  if (address < 0x10) Serial.print(0, HEX);
+  Serial.print(address, HEX);
+  Serial.print(F("\t"));
+  Serial.print(kHz);
+  Serial.print(read ? F("\tR") : F("\tW"));
+  Serial.print(F("\t"));
+  Serial.print(percentile(50));
+  Serial.print(F("\t"));
+  Serial.print(percentile(90));
+  Serial.print(F("\t"));
+  Serial.print(percentile(99));
+  Serial.print(F("\t"));
+  Serial.print(latencyMax);
+  Serial.print(F("\t"));
+  Serial.print(benchBucket);
+  Serial.print(F("\t"));
+  Serial.print(bytes * 1000.0 / elapsed, 1);
+  Serial.print(F("\t"));
+  Serial.println(errors);
+}
+
+// Latency (usec) that p percent of the last run's transfers were
+// within, to the histogram's resolution; latencyMax if that's past
+// the last bucket
+uint32_t percentile(uint8_t p)
+{
+  uint32_t want = (uint32_t)BENCH_TRANSFERS * p / 100;
+  uint32_t seen = 0;
+
+  for (uint8_t b = 0; b < BENCH_BUCKETS; b++)
+  {
+    seen += histogram[b];
+    if (seen >= want) return (uint32_t)(b + 1) * benchBucket;
+  }
+  return latencyMax;
+}
@@ -13,6 +13,7 @@
 #include <Wire.h>
 #include <Adafruit_MotorShield.h>
 #include <Encoder.h>
+#include <AxisAlly_MotorShield2.h>
 
 const int adaMotor = 1;
 const int pinEncoderA = 18;
@@ -28,13 +29,15 @@ long posMotorFuture = 0;
 long posMotorDelta = 0;
 int rateMotor = 0;
 
-Adafruit_MotorShield motorAFMS = Adafruit_MotorShield();
+/* Motor writes are collected and sent as one I2C burst, at 400KHz */
+AxisAlly_MotorShield2<TwoWire> motorAFMS(&Wire);
 
-Adafruit_DCMotor *motorM1 = motorAFMS.getMotor(1);
+AxisAlly_MotorShield2DC<TwoWire> *motorM1 = motorAFMS.getMotor(adaMotor);
 
 Encoder encMotor(pinEncoderA, pinEncoderB);
 
 void setup() {
+	Wire.begin();
 	motorAFMS.begin();
 	motorM1->setSpeed(0);
 	motorM1->run(RELEASE);
@@ -131,8 +134,10 @@ void loop() {
 
 		/* Moving ahead... */
 		if (speed != rateMotor) {
+			motorAFMS.hold();
 			motorM1->setSpeed(speed);
 			motorM1->run(direction);
+			motorAFMS.flush();
 			rateMotor = speed;
 #if DEBUG_VERBOSE
 			Serial.print("MC: speed=");
@@ -4,52 +4,47 @@
  * Sketch by max wolf / www.meso.net
  * v. 0.1 - very basic functions - mw 20061220
  *
+ * Decoded by AxisAlly_Encoder, sampled on every change of either pin,
+ * with a glitch filter: pin changes that don't hold for glitchDwell
+ * microseconds are dropped, and counted as glitches. Set it to 0 to
+ * see how many spurious counts get through without it. Pin B (19) is
+ * INT2; pin A (15) has no external interrupt, so it uses the pin
+ * change interrupt PCINT9.
  */  
 
+#include <AxisAlly_Encoder.h>
 
-int val; 
 int encoder0PinA = 15;
 int encoder0PinB = 19;
-int encoder0Pos = 0;
-int encoder0PinALast = LOW;
-int encoder0PinBLast = LOW;
-int a = LOW;
-int b = LOW;
+const unsigned int glitchDwell = 20;
+
+AxisAlly_Encoder encoder0(encoder0PinA, encoder0PinB, glitchDwell);
+
+long encoder0Pos = 0;
+
+void encoderChange() {
+  encoder0.update();
+}
+
+ISR(PCINT1_vect) {
+  encoder0.update();
+}
 
 void setup() { 
-  pinMode (encoder0PinA,INPUT_PULLUP);
-  pinMode (encoder0PinB,INPUT_PULLUP);
   Serial.begin (9600);
+  attachInterrupt(digitalPinToInterrupt(encoder0PinB), encoderChange, CHANGE);
+  PCMSK1 |= _BV(PCINT9);
+  PCICR |= _BV(PCIE1);
 } 
 
 void loop() { 
-  int changed = 0;
-  a = digitalRead(encoder0PinA);
-  b = digitalRead(encoder0PinB);
-  if ((encoder0PinALast == LOW) && (a == HIGH)) {
-    if (b == LOW) {
-      encoder0Pos--;
-    } else {
-      encoder0Pos++;
-    }
-    changed = 1;
-  }
-  if ((encoder0PinBLast == LOW) && (b == HIGH)) {
-    if (a == LOW) {
-      encoder0Pos++;
-    } else {
-      encoder0Pos--;
-    }
-    changed = 1;
-  }
-  if (changed) {
+  long pos = encoder0.read();
+
+  if (pos != encoder0Pos) {
+    encoder0Pos = pos;
     Serial.print (encoder0Pos);
-    Serial.print ("/");
-    Serial.print (a);
-    Serial.print (",");
-    Serial.print (b);
+    Serial.print (" glitches ");
+    Serial.print (encoder0.glitches());
     Serial.print ("\r\n");
   } 
-  encoder0PinALast = a;
-  encoder0PinBLast = b;
 } 
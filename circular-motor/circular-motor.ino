@@ -6,32 +6,56 @@
  * P9 -> PWM to Motor (Darlington switch, ie)
  * P2 -> Optical encoder input A
  * P3 -> Optical encoder input B
+ * P18 -> Optical encoder index (once a turn)
+ *
+ * Steps are relative; "@n" goes forward to angle n counts past the
+ * index. The angle is re-referenced at every index, so counts lost
+ * along the way don't add up from one turn to the next.
  */
 
 #define DEBUG_VERBOSE	0
 
-#include <Encoder.h>
+#include <AxisAlly_Encoder.h>
 
 const int pinPWM = 9;
 const int pinEncoderA = 2;
 const int pinEncoderB = 3;
+const int pinEncoderIndex = 18;		/* Needs to be an interrupt pin */
+
+/* Counts per turn of the disc: 4 per line */
+const long countsPerRevolution = 4 * 500;
 
 const int pwmMinimum = 90;
 const int pwmMaximum = 255;
 
-Encoder encMotor(2, 3);
+AxisAlly_Encoder encMotor(pinEncoderA, pinEncoderB);
+
+void encoderChange() {
+	encMotor.update();
+}
+
+void encoderIndex() {
+	encMotor.index();
+}
 
 void setup() {
 	pinMode(pinEncoderA, INPUT);
 	pinMode(pinEncoderB, INPUT);
+	pinMode(pinEncoderIndex, INPUT);
 	Serial.begin(9600);
 
+	encMotor.setRevolution(countsPerRevolution);
+	attachInterrupt(digitalPinToInterrupt(pinEncoderA), encoderChange, CHANGE);
+	attachInterrupt(digitalPinToInterrupt(pinEncoderB), encoderChange, CHANGE);
+	attachInterrupt(digitalPinToInterrupt(pinEncoderIndex), encoderIndex, RISING);
+
 	/* Get a direction */
 	Serial.print("Steps: ");
 }
 
 int dir = -1;
 int neg = 0;
+int absolute = 0;
 long posMotorPast = 0;
 long posMotorFuture = 0;
 int rateMotor = 0;
@@ -40,7 +64,15 @@ void readNextPosition() {
 	while (Serial.available()) {
 		int c = Serial.read();
 		if (c == '\r' || c == '\n') {
-			if (dir >= 0) {
+			if (dir >= 0 && absolute) {
+				/* Forward to that angle */
+				long ahead = (dir - encMotor.angle()) % countsPerRevolution;
+
+				if (ahead < 0)
+					ahead += countsPerRevolution;
+				Serial.print("\r\nAhead: "); Serial.print(ahead); Serial.print("\r\n");
+				posMotorFuture = encMotor.read() + ahead;
+			} else if (dir >= 0) {
 				/* Go there */
 				dir *= (neg ? -1 : 1);
 				Serial.print("\r\nPWM: "); Serial.print(dir); Serial.print("\r\n");
@@ -52,6 +84,10 @@ void readNextPosition() {
 
 			dir = -1;
 			neg = 0;
+			absolute = 0;
+		} else if (c == '@' && dir < 0 && !neg) {
+			absolute = 1;
+			Serial.write(c);
 		} else if (c == '-' && neg == 0 && dir < 0) {
 				neg = 1;
 			Serial.write(c);
@@ -88,6 +124,14 @@ void loop() {
 			Serial.print("Overstepped: ");
 			Serial.println(posMotorNow - posMotorFuture);
 			posMotorFuture = posMotorNow;
+			if (encMotor.indexed()) {
+				Serial.print("Angle: ");
+				Serial.print(encMotor.angle());
+				Serial.print(" turn ");
+				Serial.print(encMotor.revolutions());
+				Serial.print(" drift ");
+				Serial.println(encMotor.drift());
+			}
 		}
 		readNextPosition();
 	} else {
@@ -1,87 +1,164 @@
-/* Linear (forward-only) control of a DC motor
+/* Linear control of a DC motor
  *
  *
  * Pinout:
  *
- * M1 -> DC Motor control (Adafruit Motor Shield v1)
- * P19 -> Optical encoder input A
- * P15 -> Optical encoder input B
+ * M3 -> DC Motor control (Adafruit Motor Shield v1)
+ * P18 -> Optical encoder input A
+ * P27 -> Optical encoder input B
+ * P2 -> Min endstop (active high)
+ * P19 -> Carriage encoder input A (with CARRIAGE_ENCODER)
+ * P29 -> Carriage encoder input B
+ *
+ * With a carriage encoder the axis runs as a dual loop, positioning
+ * the carriage rather than the motor and taking up the backlash at
+ * reversals; 'b' shows what it has learnt the backlash to be.
  */
 
-#define DEBUG_VERBOSE	0
-
 #include <Wire.h>
+#include <EEPROM.h>
 #include <AFMotor.h>
 #include <Encoder.h>
-
-#define AXIS_OVERSHOOT	10
+#include <AxisAlly_DCEncoder.h>
+#include <AxisAlly_Scheduler.h>
+#include <AxisAlly_Profile.h>
 
 const int adaMotor = 3;
+/* Above hearing, so the motor doesn't whine. The minimum PWM that
+ * turns the motor depends on this, so measure it again if it changes.
+ */
+const int pwmFrequency = MOTOR34_64KHZ;
 const int pinEncoderA = 18;
 const int pinEncoderB = 27;
-const int pinStopMin = 35;
+const int pinStopMin = 2;		/* Needs to be an interrupt pin */
 
-int pwmMinimum = 98;
+/* A second encoder, on the carriage; 0 for none */
+#define CARRIAGE_ENCODER	0
+const int pinCarriageA = 19;
+const int pinCarriageB = 29;
+/* Motor counts per carriage count */
+#define CARRIAGE_RATIO		1.0
+
+const int pwmMinimum = 98;
 const int pwmMaximum = 255;
 
+/* Where the PWM calibration lives */
+#define EEPROM_PWM_TABLE	0
+
 #define MAX_POS 7100
 #define MIN_POS -4400
 
-AF_DCMotor imotorM1(adaMotor);
-AF_DCMotor *motorM1;
+/* Counts/sec, and counts/sec per sec */
+#define MAX_VELOCITY		2000
+#define MAX_ACCELERATION	8000
+
+/* Control loop period, in microseconds */
+#define CONTROL_PERIOD		1000
+
+AF_DCMotor motorM1(adaMotor, pwmFrequency);
 
 Encoder encMotor(pinEncoderA, pinEncoderB);
+#if CARRIAGE_ENCODER
+Encoder encCarriage(pinCarriageA, pinCarriageB);
+#endif
+
+AxisAlly_DCEncoder<AF_DCMotor, Encoder> axis(&motorM1, &encMotor);
 
-static enum {
-	HOMING,
-	MOVING,
-	IDLE
-} motorMode;
+AxisAlly_Scheduler<AxisAlly_Micros> tasks;
+
+bool moving;
+unsigned long usLast;
+
+void endstop() {
+	axis.endstop();
+}
 
 void setup() {
-	motorM1 = &imotorM1;
 	pinMode(pinEncoderA, INPUT_PULLUP);
 	pinMode(pinEncoderB, INPUT_PULLUP);
-	pinMode(pinStopMin, INPUT_PULLUP);
 	Serial.begin(9600);
+	AXISALLY_PROFILE_SETUP();
+
+	axis.setPWMRange(pwmMinimum, pwmMaximum);
+	axis.setLocationRange(MIN_POS, MAX_POS);
+	axis.setVelocityMax(MAX_VELOCITY);
+	axis.setAccelerationMax(MAX_ACCELERATION);
+	axis.setHoming(pwmMaximum, MIN_POS, pinStopMin);
+	axis.setEndstops(pinStopMin, -1);
+	attachInterrupt(digitalPinToInterrupt(pinStopMin), endstop, CHANGE);
+#if CARRIAGE_ENCODER
+	axis.setLoadEncoder(&encCarriage, CARRIAGE_RATIO);
+#endif
+
+	Serial.print("Homing: ");
+	axis.begin();
+	Serial.println(axis.getLocation());
 
-	motorMode = IDLE;
+	/* Linear PWM mapping until calibrated with 'c' */
+	if (axis.loadCalibration(EEPROM, EEPROM_PWM_TABLE))
+		Serial.println("PWM calibration loaded");
+
+	moving = false;
+	usLast = micros();
+
+	tasks.add("control", control, CONTROL_PERIOD);
+	tasks.add("serial", readNextPosition, 0);
 }
 
 int pos = -1;
 int neg = 0;
-long posMotorNow = 0;
-long posMotorFuture = 0;
-int posOvershoot;
-
-void home()
-{
-	/* Get a direction */
-	Serial.print("Homing: ");
-	motorMode = HOMING;
-	motorM1->setSpeed(255);
-	motorM1->run(BACKWARD);
-}
 
 void readNextPosition() {
+	/* Input waits until the move is done */
+	if (moving)
+		return;
+
+	AXISALLY_PROFILE_SCOPE(serial);
 	while (Serial.available()) {
 		int c = Serial.read();
 		if (c == 'h') {
-			home();
+			Serial.print("Homing: ");
+			axis.home();
+			Serial.println(axis.getLocation());
+			return;
+		}
+		if (c == 'r') {
+			/* How the tasks have been keeping up */
+			Serial.println("task runs worst_us late_us overruns skipped");
+			tasks.report(Serial);
+			tasks.resetStats();
+			return;
+		}
+		if (c == 'p') {
+			/* Section timings, with -DAXISALLY_PROFILE */
+			AXISALLY_PROFILE_DUMP(Serial);
+			AXISALLY_PROFILE_RESET();
+			return;
+		}
+		if (c == 'b') {
+			/* Motor counts between pushing one way and the other */
+			Serial.print("Backlash: ");
+			Serial.println(axis.getBacklash());
+			return;
+		}
+		if (c == 'c') {
+			/* Move somewhere mid-travel first */
+			Serial.print("Calibrating: ");
+			if (axis.calibrate()) {
+				axis.saveCalibration(EEPROM, EEPROM_PWM_TABLE);
+				Serial.println(axis.getLocation());
+			} else {
+				Serial.println("failed");
+			}
 			return;
 		}
 		if (c == '\r' || c == '\n') {
 			if (pos >= 0) {
 				/* Go there */
 				pos *= (neg ? -1 : 1);
-				if (pos > MAX_POS)
-					pos = MAX_POS;
-				if (pos < MIN_POS)
-					pos = MIN_POS;
+				axis.moveLocation(pos);
 				Serial.print("\r\nDest: "); Serial.print(pos); Serial.print("\r\n");
-				posMotorFuture = pos;
-				posOvershoot = AXIS_OVERSHOOT;
-				motorMode = MOVING;
+				moving = true;
 			}
 
 			/* Get a direction */
@@ -118,92 +195,30 @@ void readNextPosition() {
 	}
 }
 
-void loop() {
-	posMotorNow = encMotor.read();
-	long distance;
-	int direction;
-
-	if (motorMode == HOMING) {
-		Serial.print("Position: ");Serial.println(posMotorNow);
-		if (digitalRead(pinStopMin) == 1) {
-			int speed = pwmMinimum;
-			Serial.print("<ENDSTOP: Min>");
-			/* Back off the endstop */
-			delayMicroseconds(1000);
-			motorM1->run(RELEASE);
-			motorM1->setSpeed(pwmMinimum);
-			motorM1->run(FORWARD);
-			while (digitalRead(pinStopMin) == 1) {
-				if (speed < pwmMaximum)
-					speed++;
-				motorM1->setSpeed(speed);
-				delayMicroseconds(10000);
-			}
-			Serial.print("<ENDSTOP: !Min>");
-			motorM1->setSpeed(0);
-			motorM1->run(RELEASE);
-			encMotor.write(MIN_POS);
-			motorMode = IDLE;
-			Serial.println(MIN_POS);
+/* Homing and calibrating block in the serial task, and will show up
+ * as control overruns in the report; nothing moves meanwhile anyway
+ */
+void control() {
+	unsigned long usNow = micros();
+
+	if (moving) {
+		moving = axis.updateMicros(usNow - usLast);
+		if (!moving && axis.getFault()) {
+			/* Stalled, jammed or on the endstop; the motor
+			 * has been released */
+			Serial.print("Fault ");Serial.print(axis.getFault());
+			Serial.print(" at ");Serial.println(axis.getLocation());
+			axis.clearFault();
+		} else if (!moving) {
+			/* We are where we want to be */
+			Serial.print("Located: ");Serial.println(axis.getLocation());
 		}
-		return;
-	}
-	
-	if (motorMode == IDLE) {
-		readNextPosition();
-		return;
 	}
 
-	distance = posMotorFuture - posMotorNow;
-
-	if (distance >= 0) {
-		direction = FORWARD;
-	} else {
-		direction = BACKWARD;
-		distance = -distance;
-	}
-
-	if (distance < 0 && digitalRead(pinStopMin) == 1) {
-		motorMode = IDLE;
-		posMotorFuture = posMotorNow;
-		return;
-	}
-
-	if (distance == 0) {
-		if (posOvershoot) {
-		//	Serial.print("Overshoot: ");Serial.println(posOvershoot);
-			posOvershoot--;
-			motorM1->run(BRAKE);
-			motorM1->setSpeed(0);
-			delayMicroseconds(1000);
-			return;
-		}
-		/* We are where we want to be */
-		Serial.print("Located: ");Serial.println(posMotorNow);
-		motorM1->setSpeed(0);
-		motorM1->run(RELEASE);
-		motorMode = IDLE;
-	} else {
-		int speed;
-
-		if (distance > 50)
-			speed = pwmMaximum;
-		else
-			speed = pwmMinimum + distance;
-
-		Serial.println(speed);
-		/* Moving ahead... */
-		motorM1->setSpeed(speed);
-		motorM1->run(direction);
-#if DEBUG_VERBOSE
-		Serial.print("MC: speed=");
-		Serial.print(speed);
-		Serial.print(", now=");
-		Serial.print(posMotorNow);
-		Serial.print(", future=");
-		Serial.println(posMotorFuture);
-#endif
-	}
+	usLast = usNow;
 }
 
+void loop() {
+	tasks.run();
+}
 
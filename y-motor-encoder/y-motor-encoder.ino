@@ -1,4 +1,4 @@
-/* Linear (forward-only) control of a DC motor
+/* Linear control of a DC motor
  *
  *
  * Pinout:
@@ -8,65 +8,57 @@
  * P14 -> Optical encoder input B
  */
 
-#define DEBUG_VERBOSE	0
-
 #include <Wire.h>
 #include <AFMotor.h>
 #include <Encoder.h>
-
-#define AXIS_OVERSHOOT	10
+#include <AxisAlly_DCEncoder.h>
 
 const int adaMotor = 4;
+/* Above hearing, so the motor doesn't whine. The minimum PWM that
+ * turns the motor depends on this, so measure it again if it changes.
+ */
+const int pwmFrequency = MOTOR34_64KHZ;
 const int pinEncoderA = 19;
 const int pinEncoderB = 29;
 
-int pwmMinimum = 98;
+const int pwmMinimum = 98;
 const int pwmMaximum = 200;
 
 #define MAX_POS 5250
 #define MIN_POS 0
 
-AF_DCMotor imotorM1(adaMotor);
-AF_DCMotor *motorM1;
+/* Counts/sec, and counts/sec per sec */
+#define MAX_VELOCITY		1500
+#define MAX_ACCELERATION	6000
+
+AF_DCMotor motorM1(adaMotor, pwmFrequency);
 
 Encoder encMotor(pinEncoderA, pinEncoderB);
 
-static enum {
-	HOMING,
-	MOVING,
-	IDLE
-} motorMode;
+AxisAlly_DCEncoder<AF_DCMotor, Encoder> axis(&motorM1, &encMotor);
 
-long posMotorNow = 0;
-long posMotorFuture = 0;
-int posOvershoot;
+bool moving;
+unsigned long usLast;
 
 void setup() {
-	motorM1 = &imotorM1;
 	pinMode(pinEncoderA, INPUT_PULLUP);
 	pinMode(pinEncoderB, INPUT_PULLUP);
 	Serial.begin(9600);
 
-	motorMode = IDLE;
-}
+	axis.setPWMRange(pwmMinimum, pwmMaximum);
+	axis.setLocationRange(MIN_POS, MAX_POS);
+	axis.setVelocityMax(MAX_VELOCITY);
+	axis.setAccelerationMax(MAX_ACCELERATION);
+	/* No endstop; home against the frame */
+	axis.setHoming(180, -100);
 
-void home() {
-	/* Get a direction */
 	Serial.print("Homing: ");
-	motorMode = HOMING;
-	motorM1->setSpeed(180);
-	motorM1->run(BACKWARD);
-	posMotorNow = encMotor.read() + 10;
-}
+	axis.begin();
+	Serial.println(axis.getLocation());
 
-extern "C" {
-	bool stop_motor(int32_t pos, void *priv)
-	{
-		AF_DCMotor *m = (AF_DCMotor *)priv;
-		m->run(BRAKE);
-		return false;
-	}
-};
+	moving = false;
+	usLast = micros();
+}
 
 int pos = -1;
 int neg = 0;
@@ -75,22 +67,18 @@ void readNextPosition() {
 	while (Serial.available()) {
 		int c = Serial.read();
 		if (c == 'h') {
-			home();
+			Serial.print("Homing: ");
+			axis.home();
+			Serial.println(axis.getLocation());
 			return;
 		}
 		if (c == '\r' || c == '\n') {
 			if (pos >= 0) {
 				/* Go there */
 				pos *= (neg ? -1 : 1);
-				if (pos > MAX_POS)
-					pos = MAX_POS;
-				if (pos < MIN_POS)
-					pos = MIN_POS;
+				axis.moveLocation(pos);
 				Serial.print("\r\nDest: "); Serial.print(pos); Serial.print("\r\n");
-				posMotorFuture = pos;
-				encMotor.at(posMotorFuture - posMotorNow, posMotorFuture, stop_motor, motorM1);
-				posOvershoot = AXIS_OVERSHOOT;
-				motorMode = MOVING;
+				moving = true;
 			}
 
 			/* Get a direction */
@@ -128,83 +116,23 @@ void readNextPosition() {
 }
 
 void loop() {
-	long distance;
-	int direction;
-
-	if (motorMode == HOMING) {
-		static unsigned long lastms;
-		unsigned long ms = millis();
-
-		Serial.print("Position: ");Serial.println(encMotor.read());
-		if (!lastms)
-			lastms = ms + 10;
-
-		if (lastms < ms) {
-			if (encMotor.read() == posMotorNow) {
-				motorM1->setSpeed(0);
-				motorM1->run(RELEASE);
-				delay(100);
-				encMotor.write(-100);
-				motorMode = IDLE;
-				Serial.println("Done");
-			}
-			lastms = ms + 10;
-			posMotorNow = encMotor.read();
+	unsigned long usNow = micros();
+
+	if (moving) {
+		moving = axis.updateMicros(usNow - usLast);
+		if (!moving && axis.getFault()) {
+			/* Stalled or jammed; the motor has been released */
+			Serial.print("Fault ");Serial.print(axis.getFault());
+			Serial.print(" at ");Serial.println(axis.getLocation());
+			axis.clearFault();
+		} else if (!moving) {
+			/* We are where we want to be */
+			Serial.print("Located: ");Serial.println(axis.getLocation());
 		}
-		return;
-	}
-	
-	posMotorNow = encMotor.read();
-
-	if (motorMode == IDLE) {
-		readNextPosition();
-		return;
-	}
-
-	distance = posMotorFuture - posMotorNow;
-
-	if (distance >= 0) {
-		direction = FORWARD;
 	} else {
-		direction = BACKWARD;
-		distance = -distance;
+		readNextPosition();
 	}
 
-	if (distance == 0) {
-		if (posOvershoot) {
-		//	Serial.print("Overshoot: ");Serial.println(posOvershoot);
-			posOvershoot--;
-			motorM1->run(BRAKE);
-			motorM1->setSpeed(0);
-			delayMicroseconds(1000);
-			return;
-		}
-		/* We are where we want to be */
-		Serial.print("Located: ");Serial.println(posMotorNow);
-		motorM1->setSpeed(0);
-		motorM1->run(RELEASE);
-		motorMode = IDLE;
-	} else {
-		int speed;
-
-		if (distance > 50)
-			speed = pwmMaximum;
-		else
-			speed = pwmMinimum + distance;
-
-		Serial.println(speed);
-		/* Moving ahead... */
-		motorM1->setSpeed(speed);
-		motorM1->run(direction);
-#if DEBUG_VERBOSE
-		Serial.print("MC: speed=");
-		Serial.print(speed);
-		Serial.print(", now=");
-		Serial.print(posMotorNow);
-		Serial.print(", future=");
-		Serial.println(posMotorFuture);
-#endif
-	}
+	usLast = usNow;
 }
 
-
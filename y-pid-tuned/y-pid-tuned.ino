@@ -6,31 +6,77 @@
  * M1 -> DC Motor control (Adafruit Motor Shield v1)
  * P18 -> Optical encoder input A
  * P14 -> Optical encoder input B
+ *
+ * Pins, limits, PWM range and gains are kept in EEPROM, with the
+ * constants below as defaults. A line starting with ':' is a config
+ * command (see AxisAlly_Config.h): ":get", ":set kp 0.05", ":save".
+ * Gains take effect at once, pins after a reset. Autotune results are
+ * saved as they come. A save takes a few ms for each byte it changes,
+ * so the motor is stopped while it runs. A config the sketch can't
+ * run on (a pin past the board's, PWM min not below max, or travel
+ * min not below max) is refused.
  */
 
 #define DEBUG_VERBOSE	0
 
 #include <Wire.h>
+#include <EEPROM.h>
 #include <AFMotor.h>
 #include <Encoder.h>
 #include <PID_v1.h>
 #include <PID_AutoTune_v0.h>
+#include <AxisAlly_Config.h>
 
 const int adaMotor = 4;
-const int pinEncoderA = 19;
-const int pinEncoderB = 29;
 
-const int pwmMinimum = 98;
-const int pwmMaximum = 255;
-const int pwmRange = (pwmMaximum - pwmMinimum);
+struct AxisConfig {
+	int pin_a;
+	int pin_b;
+	int pwm_min;
+	int pwm_max;
+	long min_pos;
+	long max_pos;
+	float kp;
+	float ki;
+	float kd;
+};
+
+/* Until saved otherwise */
+const AxisConfig configDefaults = {
+	19, 29,			/* Encoder A, B */
+	98, 255,		/* PWM */
+	0 + 1000, 5250 - 1000,	/* Travel */
+	0.04066, 0.00210, 0.01,	/* Gains */
+};
+
+const AxisAlly_ConfigField configFields[] = {
+	AXISALLY_CONFIG_FIELD(AxisConfig, pin_a),
+	AXISALLY_CONFIG_FIELD(AxisConfig, pin_b),
+	AXISALLY_CONFIG_FIELD(AxisConfig, pwm_min),
+	AXISALLY_CONFIG_FIELD(AxisConfig, pwm_max),
+	AXISALLY_CONFIG_FIELD(AxisConfig, min_pos),
+	AXISALLY_CONFIG_FIELD(AxisConfig, max_pos),
+	AXISALLY_CONFIG_FIELD(AxisConfig, kp),
+	AXISALLY_CONFIG_FIELD(AxisConfig, ki),
+	AXISALLY_CONFIG_FIELD(AxisConfig, kd),
+};
+
+/* Change whenever AxisConfig does */
+#define CONFIG_VERSION	1
+#define CONFIG_SLOTS	8
 
-#define MAX_POS (5250 - 1000)
-#define MIN_POS (0 + 1000)
+AxisAlly_ConfigStore<AxisConfig, EEPROMClass> config(&EEPROM, 0, CONFIG_SLOTS,
+	CONFIG_VERSION, configDefaults, configFields,
+	sizeof(configFields) / sizeof(configFields[0]));
+
+/* The RAM copy; nothing below reads EEPROM */
+AxisConfig &cfg = config.get();
 
 AF_DCMotor imotorM1(adaMotor);
 AF_DCMotor *motorM1;
 
-Encoder encMotor(pinEncoderA, pinEncoderB);
+/* On the pins from the config */
+Encoder *encMotor;
 
 enum {
 	IDLE,
@@ -41,30 +87,84 @@ enum {
 double input = 0;
 double output = 0;
 double setpoint = 0;
-double kp = 0.04066, ki = 0.00210, kd = 0.01;
-double aTuneStep=pwmRange/3, aTuneNoise=1;
+double aTuneStep, aTuneNoise=1;
 unsigned int aTuneLookBack=20;
 
 byte m_PID_Mode;
-PID m_PID = PID(&input, &output, &setpoint, kp, ki, kd, DIRECT);
+PID m_PID = PID(&input, &output, &setpoint, 0, 0, 0, DIRECT);
 PID_ATune m_AutoTune = PID_ATune(&input, &output);
 
+int pwmRange() {
+	return cfg.pwm_max - cfg.pwm_min;
+}
+
+/* After the config has changed */
+void configApply() {
+	m_PID.SetTunings(cfg.kp, cfg.ki, cfg.kd);
+	m_PID.SetOutputLimits(-pwmRange(), pwmRange());
+	aTuneStep = pwmRange() / 3;
+}
+
+bool configValid() {
+	return cfg.pin_a >= 0 && cfg.pin_a < NUM_DIGITAL_PINS &&
+		cfg.pin_b >= 0 && cfg.pin_b < NUM_DIGITAL_PINS &&
+		cfg.pin_a != cfg.pin_b &&
+		cfg.pwm_min >= 0 && cfg.pwm_min < cfg.pwm_max &&
+		cfg.pwm_max <= 255 &&
+		cfg.min_pos < cfg.max_pos;
+}
+
+void motorStop() {
+	motorM1->run(BRAKE);
+	motorM1->setSpeed(0);
+}
+
+/* EEPROM writes block, and the PID isn't run while they do */
+void configSave() {
+	motorStop();
+	config.save();
+}
+
+/* One ':' line; a change that leaves the config invalid is undone */
+void configCommand(const char *line) {
+	AxisConfig before = cfg;
+
+	while (*line == ' ')
+		line++;
+	if (!strncmp(line, "save", 4))
+		motorStop();
+	config.command(line, Serial);
+	if (!configValid()) {
+		cfg = before;
+		Serial.print("invalid, not changed\r\n");
+	}
+	configApply();
+}
+
 void setup() {
 	motorM1 = &imotorM1;
-	pinMode(pinEncoderA, INPUT_PULLUP);
-	pinMode(pinEncoderB, INPUT_PULLUP);
 	Serial.begin(9600);
 
+	if (config.load())
+		Serial.println("Config loaded");
+	if (!configValid()) {
+		Serial.println("Config invalid, using defaults");
+		config.defaults();
+	}
+	encMotor = new Encoder(cfg.pin_a, cfg.pin_b);
+	pinMode(cfg.pin_a, INPUT_PULLUP);
+	pinMode(cfg.pin_b, INPUT_PULLUP);
+
 	/* Get a direction */
 	Serial.print("Homing: ");
-	motorM1->setSpeed(pwmMaximum);
+	motorM1->setSpeed(cfg.pwm_max);
 	motorM1->run(BACKWARD);
 	delay(1000);
-	encMotor.write(-100);
+	encMotor->write(-100);
 	Serial.println("Done\n");
 
+	configApply();
 	m_PID.SetMode(AUTOMATIC);
-	m_PID.SetOutputLimits(-pwmRange, pwmRange);
 	mode = IDLE;
 }
 
@@ -80,12 +180,36 @@ void pid_dump()
 int pos = -1;
 int neg = 0;
 
+/* A ':' command line, as it comes in */
+char configLine[40];
+int configLength = -1;			/* -1 when not in one */
+
 int32_t posMotorNow;
 int32_t posMotorFuture;
 
 void readNextPosition() {
 	if (Serial.available()) {
 		int c = Serial.read();
+		if (configLength >= 0) {
+			if (c == '\r' || c == '\n') {
+				configLine[configLength] = 0;
+				Serial.print("\r\n");
+				configCommand(configLine);
+				configLength = -1;
+			} else if ((c == '\b' || c == 127) && configLength > 0) {
+				Serial.print("\b \b");
+				configLength--;
+			} else if (configLength < (int)sizeof(configLine) - 1) {
+				configLine[configLength++] = c;
+				Serial.write(c);
+			}
+			return;
+		}
+		if (c == ':' && pos < 0) {
+			Serial.write(c);
+			configLength = 0;
+			return;
+		}
 		if (c == '?') {
 			pid_dump();
 			return;
@@ -98,7 +222,7 @@ void readNextPosition() {
 				mode = IDLE;
 			} else {
 				output = 0;
-				setpoint = (MIN_POS + MAX_POS) / 2;
+				setpoint = (cfg.min_pos + cfg.max_pos) / 2;
 				m_AutoTune.SetControlType(1);
 				m_AutoTune.SetNoiseBand(aTuneNoise);
 				m_AutoTune.SetOutputStep(aTuneStep);
@@ -112,10 +236,10 @@ void readNextPosition() {
 			if (pos >= 0) {
 				/* Go there */
 				pos *= (neg ? -1 : 1);
-				if (pos > MAX_POS)
-					pos = MAX_POS;
-				if (pos < MIN_POS)
-					pos = MIN_POS;
+				if (pos > cfg.max_pos)
+					pos = cfg.max_pos;
+				if (pos < cfg.min_pos)
+					pos = cfg.min_pos;
 				Serial.print("\r\nDest: "); Serial.print(pos); Serial.print("\r\n");
 				posMotorFuture = pos;
 				mode = MOVING;
@@ -158,7 +282,7 @@ void readNextPosition() {
 void loop() {
 	readNextPosition();
 
-	posMotorNow = encMotor.read();
+	posMotorNow = encMotor->read();
 
 	setpoint = posMotorFuture;
 	input = posMotorNow;
@@ -168,10 +292,11 @@ void loop() {
 
 		if (val) {
 			mode = IDLE;
-			kp = m_AutoTune.GetKp();
-			ki = m_AutoTune.GetKi();
-			kd = m_AutoTune.GetKd();
-			m_PID.SetTunings(kp, ki, kd);
+			cfg.kp = m_AutoTune.GetKp();
+			cfg.ki = m_AutoTune.GetKi();
+			cfg.kd = m_AutoTune.GetKd();
+			configApply();
+			configSave();
 			pid_dump();
 		}
 	} else {
@@ -179,26 +304,25 @@ void loop() {
 	}
 
 	if (output == 0) {
-		motorM1->run(BRAKE);
-		motorM1->setSpeed(0);
+		motorStop();
 		return;
 	}
 
 	if (output < 0) {
-		if (0 && posMotorNow < MIN_POS) {
+		if (0 && posMotorNow < cfg.min_pos) {
 			motorM1->run(FORWARD);
-			motorM1->setSpeed(pwmMinimum);
+			motorM1->setSpeed(cfg.pwm_min);
 			return;
 		}
 		motorM1->run(BACKWARD);
-		motorM1->setSpeed(map(output, -pwmRange, 0, pwmMaximum, pwmMinimum));
+		motorM1->setSpeed(map(output, -pwmRange(), 0, cfg.pwm_max, cfg.pwm_min));
 	} else {
-		if (0 && posMotorNow > MAX_POS) {
+		if (0 && posMotorNow > cfg.max_pos) {
 			motorM1->run(BACKWARD);
-			motorM1->setSpeed(pwmMinimum);
+			motorM1->setSpeed(cfg.pwm_min);
 			return;
 		}
 		motorM1->run(FORWARD);
-		motorM1->setSpeed(map(output, 0, pwmRange, pwmMinimum, pwmMaximum));
+		motorM1->setSpeed(map(output, 0, pwmRange(), cfg.pwm_min, cfg.pwm_max));
 	}
 }
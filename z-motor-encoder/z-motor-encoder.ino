@@ -3,32 +3,48 @@
  * Pinout:
  *
  * M1 -> Stepper Motor (Arduino Motor Shield v2 @0x60, M1/M2)
+ *
+ * Timer5 paces the steps, so Timer5's PWM pins (44, 45, 46) are taken.
  */
 
-#define DEBUG_VERBOSE	0
-
 #include <Wire.h>
 #include <Adafruit_MotorShield.h>
+#include <AxisAlly_Stepper.h>
 
 const int adaMotor = 1;
 
 #define MAX_POS 5250
 #define MIN_POS 0
 
+/* Steps/sec, and steps/sec per sec */
+#define MAX_VELOCITY		400
+#define MAX_ACCELERATION	1600
+
+/* Timer5 in CTC mode, clk/8. The first step of a move has to come
+ * within 16 bits of ticks, which at 2MHz means accelerating at no less
+ * than about 850 steps/sec per sec (AxisAlly_StepRamp::accelerationMin());
+ * for gentler ramps, use clk/64 (CS51 | CS50) and F_CPU / 64.
+ */
+#define STEP_TICK_HZ		(F_CPU / 8)
+#define STEP_POLL		(STEP_TICK_HZ / 1000)
+
 Adafruit_MotorShield AFMS = Adafruit_MotorShield();
 
 /* 200 steps/rotation (1.8 degree), 1 = M1/M2, 2 = M3/M4 */
 Adafruit_StepperMotor *motorM1 = AFMS.getStepper(200, 1);
 
-static enum {
-	HOMING,
-	MOVING,
-	IDLE
-} motorMode;
+AxisAlly_StepperTimed<Adafruit_StepperMotor> axis(motorM1, STEP_TICK_HZ, DOUBLE);
+
+bool moving;
+unsigned long usLast;
 
-long posMotorNow = 0;
-long posMotorFuture = 0;
-int posOvershoot;
+/* One ramp step per interrupt; when idle, look for a new move every ms */
+ISR(TIMER5_COMPA_vect)
+{
+	unsigned int ticks = axis.tick();
+
+	OCR5A = (ticks ? ticks : STEP_POLL) - 1;
+}
 
 void setup() {
 	Serial.begin(9600);
@@ -36,10 +52,25 @@ void setup() {
 	AFMS.begin();
 	/* Get a direction */
 	Serial.print("Homing: ");
-	motorMode = HOMING;
 	/* Motor RPM  = 10 */
 	motorM1->setSpeed(200);
 	motorM1->step(200, FORWARD, DOUBLE);
+
+	axis.setLocationRange(MIN_POS, MAX_POS);
+	axis.setVelocityMax(MAX_VELOCITY);
+	axis.setAccelerationMax(MAX_ACCELERATION);
+	axis.begin();
+	axis.setLocation(0);
+
+	noInterrupts();
+	TCCR5A = 0;
+	TCCR5B = _BV(WGM52) | _BV(CS51);
+	OCR5A = STEP_POLL - 1;
+	TIMSK5 |= _BV(OCIE5A);
+	interrupts();
+
+	moving = false;
+	usLast = micros();
 }
 
 int pos = -1;
@@ -56,9 +87,9 @@ void readNextPosition() {
 					pos = MAX_POS;
 				if (pos < MIN_POS)
 					pos = MIN_POS;
+				axis.moveLocation(pos);
 				Serial.print("\r\nDest: "); Serial.print(pos); Serial.print("\r\n");
-				posMotorFuture = pos;
-				motorMode = MOVING;
+				moving = true;
 			}
 
 			/* Get a direction */
@@ -96,39 +127,21 @@ void readNextPosition() {
 }
 
 void loop() {
-	long distance;
-	int direction;
+	unsigned long usNow = micros();
 
-	if (motorMode == HOMING) {
-		motorMode = IDLE;
-		return;
-	}
-	
-	if (motorMode == IDLE) {
-		readNextPosition();
-		return;
+	if (moving) {
+		moving = axis.updateMicros(usNow - usLast);
+		if (!moving) {
+			/* We are where we want to be */
+			Serial.print("Located: ");Serial.println(axis.getLocation());
+		}
 	}
 
-	distance = posMotorFuture - posMotorNow;
+	/* Timer5 keeps the ramp going meanwhile, so a new position can
+	 * be typed mid-move; the ramp slows and turns round if need be
+	 */
+	readNextPosition();
 
-	if (distance >= 0) {
-		direction = FORWARD;
-	} else {
-		direction = BACKWARD;
-		distance = -distance;
-	}
-
-	if (distance == 0) {
-		/* We are where we want to be */
-		Serial.print("Located: ");Serial.println(posMotorNow);
-		motorMode = IDLE;
-	} else {
-		/* Moving ahead... */
-		Serial.print("Step... ");Serial.print(distance);
-		motorM1->step(distance, direction, DOUBLE);
-		posMotorNow = posMotorFuture;
-		Serial.println();
-	}
+	usLast = usNow;
 }
 
-